@@ -0,0 +1,153 @@
+/* ChangeConflator.cpp
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ChangeConflator.h"
+
+namespace qtmodelserver
+{
+
+namespace
+{
+/// Beyond this, insertions and removals are replaced by a snapshot
+const int maxMessageCount = 1000;
+}
+
+void ChangeConflator::rowsInserted(int start, int end, const QByteArray& message)
+{
+	if(mNeedsSnapshot)
+		return;
+
+	const int count = end - start + 1;
+	QVector<Range> shifted;
+	shifted.reserve(mChangedRows.size() + 1);
+	for(const Range& range : qAsConst(mChangedRows))
+	{
+		if(range.second < start)
+			shifted.append(range);
+		else if(range.first >= start)
+			shifted.append(Range(range.first + count, range.second + count));
+		else
+		{
+			// Split around the inserted rows:
+			shifted.append(Range(range.first, start - 1));
+			shifted.append(Range(end + 1, range.second + count));
+		}
+	}
+	mChangedRows.swap(shifted);
+	addMessage(message);
+}
+
+void ChangeConflator::rowsRemoved(int start, int end, const QByteArray& message)
+{
+	if(mNeedsSnapshot)
+		return;
+
+	const int count = end - start + 1;
+	QVector<Range> shifted;
+	shifted.reserve(mChangedRows.size());
+	for(const Range& range : qAsConst(mChangedRows))
+	{
+		// Keep the parts before and after the removed rows:
+		Range part(-1, -1);
+		if(range.first < start)
+			part = Range(range.first, qMin(range.second, start - 1));
+		if(range.second > end)
+		{
+			const Range after(qMax(range.first, end + 1) - count, range.second - count);
+			if(part.first >= 0 && part.second + 1 == after.first)
+				part.second = after.second; // Joined by the removal
+			else
+			{
+				if(part.first >= 0)
+					shifted.append(part);
+				part = after;
+			}
+		}
+		if(part.first < 0)
+			continue;
+
+		if(!shifted.isEmpty() && shifted.last().second + 1 >= part.first)
+			shifted.last().second = part.second;
+		else
+			shifted.append(part);
+	}
+	mChangedRows.swap(shifted);
+	addMessage(message);
+}
+
+void ChangeConflator::rowsChanged(int start, int end)
+{
+	if(mNeedsSnapshot)
+		return;
+
+	// Find the first range that ends at or after the row before start, and merge from there:
+	int i = 0;
+	while(i < mChangedRows.size() && mChangedRows[i].second + 1 < start)
+		++i;
+
+	Range merged(start, end);
+	int mergeEnd = i;
+	while(mergeEnd < mChangedRows.size() && mChangedRows[mergeEnd].first <= end + 1)
+	{
+		merged.first = qMin(merged.first, mChangedRows[mergeEnd].first);
+		merged.second = qMax(merged.second, mChangedRows[mergeEnd].second);
+		++mergeEnd;
+	}
+
+	if(mergeEnd > i)
+	{
+		mChangedRows[i] = merged;
+		mChangedRows.remove(i + 1, mergeEnd - i - 1);
+	}
+	else
+		mChangedRows.insert(i, merged);
+}
+
+void ChangeConflator::reset()
+{
+	clear();
+	mNeedsSnapshot = true;
+}
+
+void ChangeConflator::clear()
+{
+	mMessages.clear();
+	mChangedRows.clear();
+	mNeedsSnapshot = false;
+}
+
+void ChangeConflator::addMessage(const QByteArray& message)
+{
+	if(mMessages.size() >= maxMessageCount)
+		reset();
+	else
+		mMessages.append(message);
+}
+
+} // namespace qtmodelserver
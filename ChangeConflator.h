@@ -0,0 +1,82 @@
+/* ChangeConflator.h
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef QTMODELSERVER_CHANGECONFLATOR_H
+#define QTMODELSERVER_CHANGECONFLATOR_H
+
+#include <QByteArrayList>
+#include <QVector>
+#include <QPair>
+
+namespace qtmodelserver
+{
+
+/// Accumulates the changes of a model between two updates to a client
+/** Changed rows are tracked as ranges, moved along with insertions and removals, so a row
+	that changes many times is only sent once. Insertions and removals are kept as the encoded
+	messages, in order. The update to send consists of these messages followed by the current
+	data of the changed rows, see JsonViewModel::updateMessage().
+
+	After a reset, or when too many insertions and removals piled up, a snapshot is cheaper than
+	the accumulated changes, and needsSnapshot() is true. */
+class ChangeConflator
+{
+public:
+	/// Row range, both inclusive
+	typedef QPair<int, int> Range;
+
+	void rowsInserted(int start, int end, const QByteArray& message);
+	void rowsRemoved(int start, int end, const QByteArray& message);
+	void rowsChanged(int start, int end);
+	void reset();
+
+	bool isEmpty() const {return !mNeedsSnapshot && mMessages.isEmpty() && mChangedRows.isEmpty();}
+
+	bool needsSnapshot() const {return mNeedsSnapshot;}
+
+	/// Encoded insertion and removal messages, in order
+	const QByteArrayList& messages() const {return mMessages;}
+
+	/// Changed rows after all insertions and removals, sorted
+	const QVector<Range>& changedRows() const {return mChangedRows;}
+
+	/// Forget all changes, after sending them
+	void clear();
+
+private:
+	void addMessage(const QByteArray& message);
+
+	QByteArrayList mMessages;
+	QVector<Range> mChangedRows;
+	bool mNeedsSnapshot = false;
+};
+
+} // namespace qtmodelserver
+
+#endif // QTMODELSERVER_CHANGECONFLATOR_H
@@ -0,0 +1,78 @@
+/* InProcessTransport.cpp
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "InProcessTransport.h"
+#include <QDebug>
+
+namespace qtmodelserver
+{
+
+void InProcessClient::sendMessage(const QByteArray& message)
+{
+	if(!mTransport)
+	{
+		qWarning() << "InProcessClient::sendMessage(): Not connected";
+		return;
+	}
+	Q_EMIT mTransport->messageReceived(mTransport->clientId(this), message);
+}
+
+void InProcessClient::close()
+{
+	if(!mTransport)
+		return;
+
+	InProcessTransport* transport = mTransport;
+	mTransport = nullptr;
+	transport->removeClient(transport->clientId(this));
+}
+
+void InProcessTransport::connectClient(InProcessClient* client, const QString& path)
+{
+	Q_ASSERT(!client->isConnected());
+
+	client->mTransport = this;
+	// Destroyed clients are not InProcessClients anymore, so only use the pointer:
+	connect(client, &QObject::destroyed, this, [this](QObject* object){removeClient(clientId(object));});
+	addClientForResource(client, path);
+}
+
+void InProcessTransport::writeMessage(QObject* connection, const QByteArray& message)
+{
+	Q_EMIT static_cast<InProcessClient*>(connection)->messageReceived(message);
+}
+
+void InProcessTransport::closeConnection(QObject* connection)
+{
+	InProcessClient* client = static_cast<InProcessClient*>(connection);
+	client->mTransport = nullptr;
+	Q_EMIT client->disconnected();
+}
+
+} // namespace qtmodelserver
@@ -0,0 +1,95 @@
+/* InProcessTransport.h
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef QTMODELSERVER_INPROCESSTRANSPORT_H
+#define QTMODELSERVER_INPROCESSTRANSPORT_H
+
+#include "ModelTransport.h"
+#include <QPointer>
+
+namespace qtmodelserver
+{
+
+class InProcessTransport;
+
+/// Client end of an InProcessTransport connection
+class InProcessClient : public QObject
+{
+	Q_OBJECT
+public:
+	explicit InProcessClient(QObject* parent = nullptr) : QObject(parent) {}
+
+	bool isConnected() const {return !mTransport.isNull();}
+
+Q_SIGNALS:
+	/// Message from the server
+	void messageReceived(const QByteArray& message);
+
+	/// The server closed the connection
+	void disconnected();
+
+public Q_SLOTS:
+	/// Send message to the server
+	void sendMessage(const QByteArray& message);
+
+	void close();
+
+private:
+	friend class InProcessTransport;
+
+	QPointer<InProcessTransport> mTransport;
+};
+
+/// Serves models to clients in the same thread by direct function calls
+/** Mostly useful for tests. Messages are delivered synchronously, without any framing or
+	event loop round trips in between. */
+class InProcessTransport : public ModelTransport
+{
+	Q_OBJECT
+public:
+	explicit InProcessTransport(QObject* parent = nullptr) : ModelTransport(parent) {}
+
+	/// Connect a client to the model at a path
+	/** The path can be followed by "?" and a query as with WebSocket URLs.
+		Connect to the client's signals before, since the snapshot is delivered right away.
+		The connection is closed when the client is destroyed or closed. The client is not
+		owned by the transport. */
+	void connectClient(InProcessClient* client, const QString& path);
+
+protected:
+	void writeMessage(QObject* connection, const QByteArray& message) override;
+	void closeConnection(QObject* connection) override;
+
+private:
+	friend class InProcessClient;
+};
+
+} // namespace qtmodelserver
+
+#endif // QTMODELSERVER_INPROCESSTRANSPORT_H
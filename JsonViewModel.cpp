@@ -28,42 +28,166 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "JsonViewModel.h"
+#include "ModelStore.h"
+#include "JsonWriter.h"
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QAbstractItemModel>
 #include <QDebug>
 #include <QMetaMethod>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <QThread>
 
 namespace qtmodelserver
 {
 
+namespace
+{
+
+/// Log an error message and return it for the reply to the client
+QString warning(const char* message)
+{
+	qWarning() << message;
+	return QString::fromLatin1(message);
+}
+
+/// Buffers are kept at least this large between messages
+const int initialBufferSize = 4096;
+
+/// Buffers grown beyond this, e.g. by a snapshot, are not kept
+const int maxRetainedBufferSize = 1 << 20;
+
+/// Empty a buffer for reuse, keeping its memory unless it grew too large
+void resetBuffer(QByteArray& buffer)
+{
+	if(buffer.capacity() > maxRetainedBufferSize || buffer.capacity() < initialBufferSize)
+	{
+		buffer = QByteArray();
+		buffer.reserve(initialBufferSize); // Also makes resize(0) keep the memory
+	}
+	else
+		buffer.resize(0);
+}
+
+/// Row ranges for parallel encoding are at least this large
+const int minRowsPerRange = 4096;
+
+/// State of JsonViewModel::writeRowItemsInParallel()
+struct ParallelEncoding
+{
+	QVector<QByteArray> ranges;
+	std::function<void (int range)> encodeRange;
+	QAtomicInt nextRange;
+	QSemaphore finished;
+};
+
+class FunctionRunnable : public QRunnable
+{
+public:
+	explicit FunctionRunnable(std::function<void ()> function) : mFunction(function) {}
+	void run() override {mFunction();}
+
+private:
+	std::function<void ()> mFunction;
+};
+
+/// Deep copy, e.g. of data referring to a reused buffer
+QByteArray copy(const QByteArray& data)
+{
+	return QByteArray(data.constData(), data.size());
+}
+
+} // namespace
+
 JsonViewModel::JsonViewModel(QObject* parent) :
 	QObject(parent),
 	mVariantToJsonValueFunction(QJsonValue::fromVariant),
 	mJsonValueToVariantFunction([](const QJsonValue& v){return v.toVariant();})
 {
-
+	resetBuffer(mBuffer);
+	resetBuffer(mItemsBuffer);
 }
 
 void JsonViewModel::sendEntireData()
 {
-	const int rowCount = m_model ? m_model->rowCount() : 0;
+	if(!hasReceivers())
+		return;
 
-	QJsonObject outObject;
-	if(useRowBasedProtocol())
+	sendMessage(entireData());
+}
+
+QByteArray JsonViewModel::entireDataMessage()
+{
+	return encodeMessage(entireData(), mStore ? qint64(mSequence) : -1);
+}
+
+void JsonViewModel::setStore(ModelStore* store)
+{
+	if(mStore == store)
+		return;
+
+	if(mStore)
 	{
-		outObject.insert(QStringLiteral("operation"), QStringLiteral("rowData"));
-		outObject.insert(QStringLiteral("items"), fetchRowsAsArray(0, rowCount - 1));
-		outObject.insert(QStringLiteral("key"), keyName());
+		disconnect(mStore, nullptr, this, nullptr);
+		mStore = nullptr;
+		unsubscribe();
 	}
-	else
+
+	mStore = store;
+
+	if(mStore)
+	{
+		mSequence = mStore->sequence();
+		connect(mStore, &ModelStore::snapshotDue, this, &JsonViewModel::writeSnapshot);
+		subscribe();
+		if(m_model)
+		{
+			// The model may differ from what was stored, so don't let anybody resume from that:
+			++mSequence;
+			writeSnapshot();
+		}
+	}
+}
+
+QByteArrayList JsonViewModel::catchUpMessages(qint64 knownSequence, const QString& knownEpoch)
+{
+	if(mStore)
 	{
-		outObject.insert(QStringLiteral("operation"), QStringLiteral("data"));
-		outObject.insert(QStringLiteral("items"), fetchRows(0, rowCount - 1));
+		if(knownSequence >= 0 && mStore->canResume(knownEpoch, quint64(knownSequence)))
+			return mStore->messagesSince(quint64(knownSequence));
+		if(!m_model && mStore->hasSnapshot())
+			return QByteArrayList{mStore->snapshot()} + mStore->messagesSince(mStore->snapshotSequence());
 	}
-	QJsonDocument outDocument(outObject);
-	sendMessage(outDocument);
+	return QByteArrayList{entireDataMessage()};
+}
+
+JsonViewModel::Message JsonViewModel::entireData()
+{
+	const int rowCount = m_model ? m_model->rowCount() : 0;
+
+	Message message;
+	message.operation = useRowBasedProtocol() ? "rowData" : "data";
+	message.items = encodeRows(0, rowCount - 1);
+	if(useRowBasedProtocol())
+		message.key = keyName(); // After encodeRows(), which may refresh the role names
+	return message;
+}
+
+void JsonViewModel::forwardMessage(const QByteArray& message)
+{
+	if(!hasReceivers())
+		return;
+
+	Q_EMIT sendMessageAsByteArray(message);
+
+	static const QMetaMethod sendMessageAsStringSignal = QMetaMethod::fromSignal(&JsonViewModel::sendMessageAsString);
+	if(isSignalConnected(sendMessageAsStringSignal))
+		Q_EMIT sendMessageAsString(QString::fromUtf8(message));
 }
 
 void JsonViewModel::receiveMessage(const QString& message)
@@ -73,44 +197,132 @@ void JsonViewModel::receiveMessage(const QString& message)
 
 void JsonViewModel::receiveMessage(const QByteArray& message)
 {
-	if(!m_model)
-		return;
+	const QByteArray reply = handleMessage(message);
+	if(!reply.isEmpty())
+		Q_EMIT sendReply(reply);
+}
 
+QByteArray JsonViewModel::handleMessage(const QByteArray& message)
+{
 	auto document = QJsonDocument::fromJson(message);
 	if(!document.isObject())
 	{
 		qWarning() << "Message is not a JSON object";
-		return;
+		return QByteArray();
 	}
 	QJsonObject object = document.object();
-	auto operationIt = object.find("operation");
-	if(operationIt == object.end())
+	const QJsonValue id = object.value(QStringLiteral("id"));
+
+	QString error;
+	if(!m_model)
+		error = QStringLiteral("No model");
+	else
 	{
-		qWarning() << "No operation in message";
-		return;
+		if(!mAttached)
+			mKeyToRowCache.clear(); // Rows may have moved without notice
+
+		if(object.value(QStringLiteral("operation")).toString() == QStringLiteral("transaction"))
+			error = applyTransaction(object);
+		else
+			error = applyOperation(object);
+
+		if(!m_model->submit())
+		{
+			qWarning() << "Could not submit";
+			if(error.isEmpty())
+				error = QStringLiteral("Could not submit");
+		}
 	}
 
-	if(!operationIt->isString())
+	if(id.isUndefined())
+		return QByteArray();
+	return replyMessage(id, error);
+}
+
+QByteArray JsonViewModel::replyMessage(const QJsonValue& id, const QString& error)
+{
+	QJsonObject outObject;
+	if(error.isEmpty())
+		outObject.insert(QStringLiteral("operation"), QStringLiteral("ack"));
+	else
 	{
-		qWarning() << "Operation is not a string";
-		return;
+		outObject.insert(QStringLiteral("operation"), QStringLiteral("error"));
+		outObject.insert(QStringLiteral("message"), error);
 	}
+	outObject.insert(QStringLiteral("id"), id);
+	return QJsonDocument(outObject).toJson(QJsonDocument::Compact);
+}
 
-	auto itemsIt = object.find("items");
-	if(itemsIt == object.end())
+QByteArray JsonViewModel::updateMessage(const QByteArrayList& messages, const QVector<QPair<int, int>>& changedRows)
+{
+	QVector<Message> changes;
+	changes.reserve(changedRows.size());
+	for(const auto& rows : changedRows)
 	{
-		qWarning() << "No items in message";
-		return;
+		Message message;
+		message.operation = "rowDataChanged";
+		message.start = rows.first;
+		message.end = rows.second;
+		message.items = copy(encodeRows(rows.first, rows.second));
+		changes.append(message);
 	}
 
+	return encodeBatch(changes, mStore ? qint64(mSequence) : -1, messages);
+}
+
+QString JsonViewModel::applyTransaction(const QJsonObject& object)
+{
+	auto operationsIt = object.find("operations");
+	if(operationsIt == object.end() || !operationsIt->isArray())
+		return warning("No operations array in transaction");
+
+	// Collect the resulting changes, so they go out as a single message:
+	++mBatchDepth;
+	QString error;
+	const QJsonArray operations = operationsIt->toArray();
+	for(int i = 0; i < operations.size() && error.isEmpty(); ++i)
+	{
+		if(!operations[i].isObject())
+			error = warning("Operation is not an object");
+		else
+			error = applyOperation(operations[i].toObject());
+		if(!error.isEmpty())
+			error = QStringLiteral("Operation %1: %2").arg(i).arg(error);
+	}
+	--mBatchDepth;
+
+	QVector<Message> batch;
+	batch.swap(mBatch);
+	// The changes were already reported while batching:
+	if(mUseBatchMessages && batch.size() > 1)
+		send(encodeBatch(batch, mStore ? qint64(++mSequence) : -1));
+	else
+	{
+		for(const Message& message : qAsConst(batch))
+			send(encodeMessage(message, mStore ? qint64(++mSequence) : -1));
+	}
+
+	return error;
+}
+
+QString JsonViewModel::applyOperation(const QJsonObject& object)
+{
+	auto operationIt = object.find("operation");
+	if(operationIt == object.end())
+		return warning("No operation in message");
+
+	if(!operationIt->isString())
+		return warning("Operation is not a string");
+
+	auto itemsIt = object.find("items");
+	if(itemsIt == object.end())
+		return warning("No items in message");
+
 	auto operationString = operationIt->toString();
 	if(operationString == "changeData")
 	{
 		if(!itemsIt->isObject())
-		{
-			qWarning() << "items is not an object";
-			return;
-		}
+			return warning("items is not an object");
 		QJsonObject items = itemsIt->toObject();
 		for(auto itemIt = items.begin(); itemIt != items.end(); ++itemIt)
 		{
@@ -121,15 +333,10 @@ void JsonViewModel::receiveMessage(const QByteArray& message)
 				continue;
 			}
 			if(!itemIt->isObject())
-			{
-				qWarning() << "item is not an object";
-				return;
-			}
+				return warning("item is not an object");
 			QJsonObject item = itemIt->toObject();
 			setItemData(row, item);
 		}
-		if(!m_model->submit())
-			qWarning() << "Could not submit after changing";
 	}
 	else if(operationString == "remove")
 	{
@@ -154,8 +361,6 @@ void JsonViewModel::receiveMessage(const QByteArray& message)
 			if(!m_model->removeRow(row))
 				qWarning() << "Could not remove row";
 		}
-		if(!m_model->submit())
-			qWarning() << "Could not submit after removing";
 	}
 	else if(operationString == "insert")
 	{
@@ -164,39 +369,35 @@ void JsonViewModel::receiveMessage(const QByteArray& message)
 		if(itemsIt->isObject())
 		{
 			QJsonObject items = itemsIt->toObject();
-			if(m_model->insertRows(row, items.size()))
+			if(!m_model->insertRows(row, items.size()))
+				return warning("Could not insert rows");
+			for(auto itemIt = items.begin(); itemIt != items.end(); ++itemIt)
 			{
-				for(auto itemIt = items.begin(); itemIt != items.end(); ++itemIt)
-				{
-					QJsonObject item = itemIt->toObject();
-					item.insert(keyName(), itemIt.key()); // Add key to item
-					setItemData(row, item);
-					row++;
-				}
+				QJsonObject item = itemIt->toObject();
+				item.insert(keyName(), itemIt.key()); // Add key to item
+				setItemData(row, item);
+				row++;
 			}
-			else
-				qWarning() <<"Could not insert rows";
 		}
 		else if(itemsIt->isArray())
 		{
 			QJsonArray items = itemsIt->toArray();
-			if(m_model->insertRows(row, items.size()))
+			if(!m_model->insertRows(row, items.size()))
+				return warning("Could not insert rows from array");
+			for(auto itemIt = items.begin(); itemIt != items.end(); ++itemIt)
 			{
-				for(auto itemIt = items.begin(); itemIt != items.end(); ++itemIt)
-				{
-					QJsonObject item = itemIt->toObject();
-					setItemData(row, item);
-					row++;
-				}
+				QJsonObject item = itemIt->toObject();
+				setItemData(row, item);
+				row++;
 			}
-			else
-				qWarning() <<"Could not insert rows from array";
 		}
 		else
-			qWarning() << "Items to insert neither object nor array";
-		if(!m_model->submit())
-			qWarning() << "Could not submit after inserting";
+			return warning("Items to insert neither object nor array");
 	}
+	else
+		return warning("Unknown operation");
+
+	return QString();
 }
 
 void JsonViewModel::setModel(QAbstractItemModel* model)
@@ -206,23 +407,19 @@ void JsonViewModel::setModel(QAbstractItemModel* model)
 
 	if(m_model)
 	{
-		disconnect(m_model, &QAbstractItemModel::dataChanged, this, &JsonViewModel::dataChanged);
-		disconnect(m_model, &QAbstractItemModel::rowsAboutToBeRemoved, this, &JsonViewModel::rowsAboutToBeRemoved);
-		disconnect(m_model, &QAbstractItemModel::rowsInserted, this, &JsonViewModel::rowsInserted);
-		disconnect(m_model, &QAbstractItemModel::modelReset, this, &JsonViewModel::modelReset);
+		if(mAttached)
+			disconnectModel();
 		mRoleNames.clear();
 		mHeaderData.clear();
+		mFields.clear();
 		mKeyToRowCache.clear();
 	}
 
 	m_model = model;
 
-	if(m_model)
+	if(m_model && mAttached)
 	{
-		connect(m_model, &QAbstractItemModel::dataChanged, this, &JsonViewModel::dataChanged);
-		connect(m_model, &QAbstractItemModel::rowsAboutToBeRemoved, this, &JsonViewModel::rowsAboutToBeRemoved);
-		connect(m_model, &QAbstractItemModel::rowsInserted, this, &JsonViewModel::rowsInserted);
-		connect(m_model, &QAbstractItemModel::modelReset, this, &JsonViewModel::modelReset);
+		connectModel();
 		modelReset();
 	}
 
@@ -235,6 +432,7 @@ void JsonViewModel::setKeyItem(int keyItem)
 		return;
 
 	mKeyItem = keyItem;
+	mFields.clear();
 	Q_EMIT keyItemChanged(mKeyItem);
 }
 
@@ -244,6 +442,7 @@ void JsonViewModel::setUseColumns(bool useColumns)
 		return;
 
 	mUseColumns = useColumns;
+	mFields.clear();
 	Q_EMIT useColumnsChanged(mUseColumns);
 }
 
@@ -253,6 +452,7 @@ void JsonViewModel::setUseRowBasedProtocol(bool useRowBasedProtocol)
 		return;
 
 	mUseRowBasedProtocol = useRowBasedProtocol;
+	mFields.clear();
 	Q_EMIT useRowBasedProtocolChanged(mUseRowBasedProtocol);
 }
 
@@ -265,28 +465,86 @@ void JsonViewModel::setCacheRoleNames(bool cacheRoleNames)
 	Q_EMIT cacheRoleNamesChanged(mCacheRoleNames);
 }
 
+void JsonViewModel::setParallelEncoding(bool parallelEncoding)
+{
+	if (mParallelEncoding == parallelEncoding)
+		return;
+
+	mParallelEncoding = parallelEncoding;
+	Q_EMIT parallelEncodingChanged(mParallelEncoding);
+}
+
+void JsonViewModel::setUseBatchMessages(bool useBatchMessages)
+{
+	if (mUseBatchMessages == useBatchMessages)
+		return;
+
+	mUseBatchMessages = useBatchMessages;
+	Q_EMIT useBatchMessagesChanged(mUseBatchMessages);
+}
+
+void JsonViewModel::setAttached(bool attached)
+{
+	if (mAttached == attached)
+		return;
+
+	mAttached = attached;
+	if(m_model)
+	{
+		if(mAttached)
+		{
+			connectModel();
+			updateModelInfo();
+		}
+		else
+			disconnectModel();
+	}
+	Q_EMIT attachedChanged(mAttached);
+}
+
+void JsonViewModel::subscribe()
+{
+	if(mSubscriberCount++ == 0)
+		setAttached(true);
+	Q_EMIT subscriberCountChanged(mSubscriberCount);
+}
+
+void JsonViewModel::unsubscribe()
+{
+	Q_ASSERT(mSubscriberCount > 0);
+	if(mSubscriberCount <= 0)
+		return;
+
+	if(--mSubscriberCount == 0)
+		setAttached(false);
+	Q_EMIT subscriberCountChanged(mSubscriberCount);
+}
+
+void JsonViewModel::writeSnapshot()
+{
+	if(mStore && m_model)
+		mStore->writeSnapshot(mSequence, entireDataMessage());
+}
+
 void JsonViewModel::dataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector<int>& roles)
 {
 	Q_UNUSED(roles);
 	Q_ASSERT(m_model);
 
-	QJsonObject outObject;
+	if(!hasReceivers())
+		return;
+
+	Message message;
 	if(mUseRowBasedProtocol)
 	{
-		const int first = topLeft.row();
-		const int last = bottomRight.row();
-		outObject.insert(QStringLiteral("operation"), QStringLiteral("rowDataChanged"));
-		outObject.insert(QStringLiteral("items"), fetchRowsAsArray(first, last));
-		outObject.insert(QStringLiteral("start"), first);
-		outObject.insert(QStringLiteral("end"), last);
+		message.operation = "rowDataChanged";
+		message.start = topLeft.row();
+		message.end = bottomRight.row();
 	}
 	else
-	{
-		outObject.insert(QStringLiteral("operation"), QStringLiteral("dataChanged"));
-		outObject.insert(QStringLiteral("items"), fetchRows(topLeft.row(), bottomRight.row()));
-	}
-	QJsonDocument outDocument(outObject);
-	sendMessage(outDocument);
+		message.operation = "dataChanged";
+	message.items = encodeRows(topLeft.row(), bottomRight.row());
+	sendMessage(message);
 }
 
 void JsonViewModel::rowsAboutToBeRemoved(const QModelIndex& parent, int start, int end)
@@ -296,29 +554,34 @@ void JsonViewModel::rowsAboutToBeRemoved(const QModelIndex& parent, int start, i
 
 	mKeyToRowCache.clear(); // TODO
 
-	QJsonObject outObject;
+	if(!hasReceivers())
+		return;
+
+	Message message;
 
 	if(mUseRowBasedProtocol)
 	{
-		outObject.insert(QStringLiteral("operation"), QStringLiteral("rowsRemoved"));
-		outObject.insert(QStringLiteral("start"), start);
-		outObject.insert(QStringLiteral("end"), end);
+		message.operation = "rowsRemoved";
+		message.start = start;
+		message.end = end;
 	}
 	else
 	{
-		QJsonArray items;
+		resetBuffer(mItemsBuffer);
+		JsonWriter writer(mItemsBuffer);
+		writer.beginArray();
 		for(int i = start; i <= end; ++i)
 		{
 			QModelIndex index = m_model->index(i, 0);
-			items.append(m_model->data(index, mKeyItem).toString());
+			writer.value(m_model->data(index, mKeyItem).toString());
 		}
+		writer.endArray();
 
-		outObject.insert(QStringLiteral("operation"), QStringLiteral("removed"));
-		outObject.insert(QStringLiteral("items"), items);
+		message.operation = "removed";
+		message.items = QByteArray::fromRawData(mItemsBuffer.constData(), mItemsBuffer.size());
 	}
 
-	QJsonDocument outDocument(outObject);
-	sendMessage(outDocument);
+	sendMessage(message);
 }
 
 void JsonViewModel::rowsInserted(const QModelIndex& parent, int start, int end)
@@ -328,117 +591,195 @@ void JsonViewModel::rowsInserted(const QModelIndex& parent, int start, int end)
 
 	mKeyToRowCache.clear(); // TODO
 
-	QJsonObject outObject;
+	if(!hasReceivers())
+		return;
+
+	Message message;
 	if(mUseRowBasedProtocol)
 	{
-		outObject.insert(QStringLiteral("operation"), QStringLiteral("rowsInserted"));
-		outObject.insert(QStringLiteral("items"), fetchRowsAsArray(start, end));
-		outObject.insert(QStringLiteral("start"), start);
-		outObject.insert(QStringLiteral("end"), end);
+		message.operation = "rowsInserted";
+		message.start = start;
+		message.end = end;
 	}
 	else
-	{
-		outObject.insert(QStringLiteral("operation"), QStringLiteral("inserted"));
-		outObject.insert(QStringLiteral("items"), fetchRows(start, end));
-	}
-	QJsonDocument outDocument(outObject);
-	sendMessage(outDocument);
+		message.operation = "inserted";
+	message.items = encodeRows(start, end);
+	sendMessage(message);
 }
 
 void JsonViewModel::modelReset()
 {
+	updateModelInfo();
+	sendEntireData();
+}
+
+void JsonViewModel::connectModel()
+{
+	Q_ASSERT(m_model);
+	connect(m_model, &QAbstractItemModel::dataChanged, this, &JsonViewModel::dataChanged);
+	connect(m_model, &QAbstractItemModel::rowsAboutToBeRemoved, this, &JsonViewModel::rowsAboutToBeRemoved);
+	connect(m_model, &QAbstractItemModel::rowsInserted, this, &JsonViewModel::rowsInserted);
+	connect(m_model, &QAbstractItemModel::modelReset, this, &JsonViewModel::modelReset);
+}
+
+void JsonViewModel::disconnectModel()
+{
+	Q_ASSERT(m_model);
+	disconnect(m_model, &QAbstractItemModel::dataChanged, this, &JsonViewModel::dataChanged);
+	disconnect(m_model, &QAbstractItemModel::rowsAboutToBeRemoved, this, &JsonViewModel::rowsAboutToBeRemoved);
+	disconnect(m_model, &QAbstractItemModel::rowsInserted, this, &JsonViewModel::rowsInserted);
+	disconnect(m_model, &QAbstractItemModel::modelReset, this, &JsonViewModel::modelReset);
+}
+
+void JsonViewModel::updateModelInfo()
+{
+	Q_ASSERT(m_model);
 	mRoleNames = m_model->roleNames();
+	mHeaderData.clear();
 	int columnCount = m_model->columnCount();
 	for(int i = 0; i < columnCount; ++i)
 		mHeaderData[i] = m_model->headerData(i, Qt::Horizontal).toString();
 	mKeyToRowCache.clear();
 	mRowKeys.clear();
 	mRowKeys.resize(m_model->rowCount());
-	sendEntireData();
+	mFields.clear();
 }
 
-QJsonObject JsonViewModel::fetchRows(int start, int end)
+QByteArray JsonViewModel::encodeRows(int start, int end)
 {
-	if(!mCacheRoleNames && !mUseColumns)
-		mRoleNames = m_model->roleNames();
+	resetBuffer(mItemsBuffer);
+	JsonWriter writer(mItemsBuffer);
+	writeRows(writer, start, end);
+	return QByteArray::fromRawData(mItemsBuffer.constData(), mItemsBuffer.size());
+}
 
-	QJsonObject outData;
-	for(int i = start; i <= end; ++i)
+void JsonViewModel::writeRows(JsonWriter& writer, int start, int end)
+{
+	if(!mCacheRoleNames && !mUseColumns && m_model)
 	{
-		QString key;
-		QJsonObject outValue;
-		if(mUseColumns)
+		const QHash<int, QByteArray> roleNames = m_model->roleNames();
+		if(roleNames != mRoleNames)
 		{
-			QModelIndex keyIndex = m_model->index(i, mKeyItem);
-			QVariant keyValue = m_model->data(keyIndex);
-			if(!keyValue.isValid())
-			{
-				continue; // Skip invalid keys
-			}
-			key = keyValue.toString();
-			for(auto it = mHeaderData.begin(); it != mHeaderData.end(); ++it)
-			{
-				QModelIndex index = m_model->index(i, it.key());
-				if(it.key() != mKeyItem)
-					outValue.insert(it.value(), mVariantToJsonValueFunction(m_model->data(index)));
-			}
+			mRoleNames = roleNames;
+			mFields.clear();
 		}
+	}
+
+	if(mFields.isEmpty())
+		updateFields();
+	const QVector<Field>& fields = mFields;
+
+	if(mUseRowBasedProtocol)
+	{
+		writer.beginArray();
+		if(mParallelEncoding && end - start + 1 >= 2 * minRowsPerRange)
+			writeRowItemsInParallel(writer, fields, start, end);
 		else
-		{
-			QModelIndex index = m_model->index(i, 0);
-			QVariant keyValue = m_model->data(index, mKeyItem);
-			if(!keyValue.isValid())
-				continue; // Skip invalid keys
-			key = keyValue.toString();
-			outValue = fetchRowRoles(index);
-		}
-		outData.insert(key, outValue);
-		mKeyToRowCache[key] = i;
+			writeRowItems(writer, fields, start, end);
+		writer.endArray();
+		return;
 	}
 
-	return outData;
+	writer.beginObject();
+	for(int i = start; i <= end; ++i)
+	{
+		const QModelIndex keyIndex = mUseColumns ? m_model->index(i, mKeyItem) : m_model->index(i, 0);
+		const QVariant keyValue = mUseColumns ? m_model->data(keyIndex) : m_model->data(keyIndex, mKeyItem);
+		if(!keyValue.isValid())
+			continue; // Skip invalid keys
+		const QString key = keyValue.toString();
+		writer.key(key);
+		mKeyToRowCache[key] = i;
+		writeItem(writer, fields, i);
+	}
+	writer.endObject();
 }
 
-QJsonArray JsonViewModel::fetchRowsAsArray(int start, int end)
+void JsonViewModel::writeRowItems(JsonWriter& writer, const QVector<Field>& fields, int start, int end) const
 {
-	if(!mCacheRoleNames && !mUseColumns)
-		mRoleNames = m_model->roleNames();
-
-	QJsonArray out;
 	for(int i = start; i <= end; ++i)
+		writeItem(writer, fields, i);
+}
+
+void JsonViewModel::writeItem(JsonWriter& writer, const QVector<Field>& fields, int row) const
+{
+	writer.beginObject();
+	const QModelIndex rowIndex = m_model->index(row, 0);
+	for(const Field& field: fields)
 	{
-		QJsonObject outValue;
+		writer.encodedKey(field.encodedName);
 		if(mUseColumns)
-		{
-			for(auto it = mHeaderData.begin(); it != mHeaderData.end(); ++it)
-			{
-				QModelIndex index = m_model->index(i, it.key());
-				outValue.insert(it.value(), mVariantToJsonValueFunction(m_model->data(index)));
-			}
-		}
+			writer.value(mVariantToJsonValueFunction(m_model->data(m_model->index(row, field.item))));
 		else
-		{
-			QModelIndex index = m_model->index(i, 0);
-			outValue = fetchRowRoles(index, true);
-		}
-		out.append(outValue);
+			writer.value(mVariantToJsonValueFunction(m_model->data(rowIndex, field.item)));
 	}
+	writer.endObject();
+}
 
-	return out;
+void JsonViewModel::writeRowItemsInParallel(JsonWriter& writer, const QVector<Field>& fields, int start, int end) const
+{
+	const int rowCount = end - start + 1;
+	const int rangeCount = qMin(rowCount / minRowsPerRange, QThread::idealThreadCount() * 4); // Some more than threads, for balance
+
+	// Shared with the pool threads, which might only get to run after everything is done here:
+	auto state = QSharedPointer<ParallelEncoding>::create();
+	state->ranges.resize(rangeCount);
+	QByteArray* ranges = state->ranges.data();
+	state->encodeRange = [this, fields, start, rowCount, rangeCount, ranges](int range)
+	{
+		JsonWriter rangeWriter(ranges[range]);
+		rangeWriter.beginArray();
+		const int first = start + int(qint64(rowCount) * range / rangeCount);
+		const int last = start + int(qint64(rowCount) * (range + 1) / rangeCount) - 1;
+		writeRowItems(rangeWriter, fields, first, last);
+		rangeWriter.endArray();
+	};
+
+	auto work = [state]()
+	{
+		int range;
+		while((range = state->nextRange.fetchAndAddRelaxed(1)) < state->ranges.size())
+		{
+			state->encodeRange(range);
+			state->finished.release();
+		}
+	};
+	QThreadPool* pool = QThreadPool::globalInstance();
+	const int helperCount = qMin(rangeCount - 1, pool->maxThreadCount());
+	for(int i = 0; i < helperCount; ++i)
+		pool->start(new FunctionRunnable(work));
+	work();
+	state->finished.acquire(rangeCount);
+
+	// Concatenate in order, without the brackets of each range:
+	for(const QByteArray& range : qAsConst(state->ranges))
+		writer.rawValue(QByteArray::fromRawData(range.constData() + 1, range.size() - 2));
 }
 
-QJsonObject JsonViewModel::fetchRowRoles(const QModelIndex& index, bool includeKeyItem)
+void JsonViewModel::updateFields()
 {
-	Q_ASSERT(m_model);
+	// The key is part of the item in the row based protocol, and the item's name otherwise:
+	const bool includeKeyItem = mUseRowBasedProtocol;
 
-	QJsonObject outValue;
-	for(auto it = mRoleNames.begin(); it != mRoleNames.end(); ++it)
+	mFields.clear();
+	if(mUseColumns)
 	{
-		if(includeKeyItem || it.key() != mKeyItem)
-			outValue.insert(it.value(), mVariantToJsonValueFunction(m_model->data(index, it.key())));
+		mFields.reserve(mHeaderData.size());
+		for(auto it = mHeaderData.begin(); it != mHeaderData.end(); ++it)
+		{
+			if(includeKeyItem || it.key() != mKeyItem)
+				mFields.append(Field{it.key(), JsonWriter::encodeKey(it.value().toUtf8())});
+		}
+	}
+	else
+	{
+		mFields.reserve(mRoleNames.size());
+		for(auto it = mRoleNames.begin(); it != mRoleNames.end(); ++it)
+		{
+			if(includeKeyItem || it.key() != mKeyItem)
+				mFields.append(Field{it.key(), JsonWriter::encodeKey(it.value())});
+		}
 	}
-
-	return outValue;
 }
 
 void JsonViewModel::setItemData(int row, const QJsonObject& item)
@@ -505,14 +846,140 @@ int JsonViewModel::getRowForKey(const QString& key)
 	return -1; // Row not found
 }
 
-void JsonViewModel::sendMessage(const QJsonDocument& document)
+bool JsonViewModel::hasReceivers() const
 {
-	QByteArray data = document.toJson();
-	Q_EMIT sendMessageAsByteArray(data);
-
+	static const QMetaMethod sendMessageAsByteArraySignal = QMetaMethod::fromSignal(&JsonViewModel::sendMessageAsByteArray);
 	static const QMetaMethod sendMessageAsStringSignal = QMetaMethod::fromSignal(&JsonViewModel::sendMessageAsString);
-	if(isSignalConnected(sendMessageAsStringSignal))
-		Q_EMIT sendMessageAsString(QString::fromUtf8(data));
+	return mStore || isSignalConnected(sendMessageAsByteArraySignal) || isSignalConnected(sendMessageAsStringSignal);
+}
+
+void JsonViewModel::sendMessage(const Message& message)
+{
+	if(mBatchDepth > 0)
+	{
+		reportChange(message, QByteArray());
+		if(!mBatch.isEmpty() && mergeChange(mBatch.last(), message))
+			return;
+		mBatch.append(message);
+		mBatch.last().items = copy(message.items); // Might refer to mItemsBuffer
+		return;
+	}
+
+	const QByteArray data = encodeMessage(message, mStore ? qint64(++mSequence) : -1);
+	send(data);
+	reportChange(message, data);
+}
+
+void JsonViewModel::reportChange(const Message& message, const QByteArray& data)
+{
+	static const QMetaMethod changeSentSignal = QMetaMethod::fromSignal(&JsonViewModel::changeSent);
+	if(!isSignalConnected(changeSentSignal))
+		return;
+
+	if(qstrcmp(message.operation, "rowDataChanged") == 0)
+		Q_EMIT changeSent(RowDataChanged, message.start, message.end, QByteArray());
+	else if(qstrcmp(message.operation, "rowsInserted") == 0)
+		Q_EMIT changeSent(RowsInserted, message.start, message.end, data.isEmpty() ? encodeMessage(message, -1) : data);
+	else if(qstrcmp(message.operation, "rowsRemoved") == 0)
+		Q_EMIT changeSent(RowsRemoved, message.start, message.end, data.isEmpty() ? encodeMessage(message, -1) : data);
+	else if(qstrcmp(message.operation, "rowData") == 0)
+		Q_EMIT changeSent(Reset, 0, -1, QByteArray());
+}
+
+void JsonViewModel::send(const QByteArray& data)
+{
+	if(mStore)
+		mStore->append(mSequence, data);
+	forwardMessage(data);
+}
+
+QByteArray JsonViewModel::encodeMessage(const Message& message, qint64 sequence)
+{
+	resetBuffer(mBuffer);
+	JsonWriter writer(mBuffer);
+	writer.beginObject();
+	writeMessage(writer, message);
+	if(sequence >= 0)
+		writeSequence(writer, sequence);
+	writer.endObject();
+
+	// The only allocation for the message, which is shared by all receivers:
+	return copy(mBuffer);
+}
+
+QByteArray JsonViewModel::encodeBatch(const QVector<Message>& batch, qint64 sequence, const QByteArrayList& encodedMessages)
+{
+	resetBuffer(mBuffer);
+	JsonWriter writer(mBuffer);
+	writer.beginObject();
+	writer.key("operation");
+	writer.value("batch");
+	writer.key("items");
+	writer.beginArray();
+	for(const QByteArray& message : encodedMessages)
+		writer.rawValue(message);
+	for(const Message& message: batch)
+	{
+		writer.beginObject();
+		writeMessage(writer, message);
+		writer.endObject();
+	}
+	writer.endArray();
+	if(sequence >= 0)
+		writeSequence(writer, sequence);
+	writer.endObject();
+	return copy(mBuffer);
+}
+
+void JsonViewModel::writeSequence(JsonWriter& writer, qint64 sequence)
+{
+	writer.key("sequence");
+	writer.value(sequence);
+	writer.key("epoch");
+	writer.value(mStore->epoch());
+}
+
+void JsonViewModel::writeMessage(JsonWriter& writer, const Message& message)
+{
+	writer.key("operation");
+	writer.value(message.operation);
+	if(!message.items.isEmpty())
+	{
+		writer.key("items");
+		writer.rawValue(message.items);
+	}
+	if(message.start >= 0)
+	{
+		writer.key("start");
+		writer.value(message.start);
+		writer.key("end");
+		writer.value(message.end);
+	}
+	if(qstrcmp(message.operation, "rowData") == 0)
+	{
+		writer.key("key");
+		writer.value(message.key);
+	}
+}
+
+bool JsonViewModel::mergeChange(Message& previous, const Message& next)
+{
+	if(qstrcmp(previous.operation, "rowDataChanged") != 0 || qstrcmp(next.operation, "rowDataChanged") != 0)
+		return false;
+
+	if(next.start == previous.start && next.end == previous.end)
+		previous.items = copy(next.items);
+	else if(next.start == previous.end + 1)
+	{
+		// Join the two arrays:
+		previous.items.chop(1);
+		previous.items.append(',');
+		previous.items.append(next.items.constData() + 1, next.items.size() - 1);
+		previous.end = next.end;
+	}
+	else
+		return false;
+	return true;
 }
 
 } // namespace qtmodelserver
@@ -33,6 +33,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QObject>
 #include <QVector>
 #include <QHash>
+#include <QByteArrayList>
+#include <QPair>
 
 #include <functional>
 
@@ -41,6 +43,9 @@ class QAbstractItemModel;
 namespace qtmodelserver
 {
 
+class ModelStore;
+class JsonWriter;
+
 /// Provides a JSON message interface to a QAbstractItemModel
 /** Set the model property for the QAbstractItemModel side. Connect
 	sendMessageAsString() or sendMessageAsByteArray() signal and
@@ -80,7 +85,43 @@ class JsonViewModel : public QObject
 	*/
 	Q_PROPERTY(bool cacheRoleNames READ cacheRoleNames WRITE setCacheRoleNames NOTIFY cacheRoleNamesChanged)
 
+	/// Read and encode large numbers of rows with several threads
+	/** Snapshots and other messages with many rows are split into row ranges, which are encoded
+		in parallel on QThreadPool::globalInstance(). Only enable this if the model's index() and
+		data() may be called from several threads at once, e.g. for an immutable model. The
+		variant to JSON conversion function must be thread-safe as well.
+		@note Only used with the row based protocol.
+
+		Default is "false". */
+	Q_PROPERTY(bool parallelEncoding READ parallelEncoding WRITE setParallelEncoding NOTIFY parallelEncodingChanged)
+
+	/// Send the changes of a transaction as a single "batch" message
+	/** Only enable this if all clients understand "batch" messages, since older clients
+		ignore them and would miss the whole transaction. Otherwise the changes are sent as
+		separate messages, with neighbouring changes still merged.
+
+		Default is "false". */
+	Q_PROPERTY(bool useBatchMessages READ useBatchMessages WRITE setUseBatchMessages NOTIFY useBatchMessagesChanged)
+
+	/// Observe the model's signals
+	/** When false, the model's signals are not connected, so changes to the model cost nothing
+		here and no messages are sent for them. Role names, header data and the key cache are
+		refreshed when attaching again. Use this to keep idle models around cheaply, but send the
+		entire data again after attaching since changes were missed in the meantime.
+
+		Default is "true". */
+	Q_PROPERTY(bool attached READ attached WRITE setAttached NOTIFY attachedChanged)
+
+	/// Number of clients currently subscribed
+	/** @see subscribe()
+		@see unsubscribe() */
+	Q_PROPERTY(int subscriberCount READ subscriberCount NOTIFY subscriberCountChanged)
+
 public:
+	/// Kind of change reported by changeSent()
+	enum Change {RowsInserted, RowsRemoved, RowDataChanged, Reset};
+	Q_ENUM(Change)
+
 	explicit JsonViewModel(QObject* parent = nullptr);
 
 	QAbstractItemModel* model() const {return m_model;}
@@ -93,12 +134,67 @@ public:
 
 	bool cacheRoleNames() const {return mCacheRoleNames;}
 
+	bool parallelEncoding() const {return mParallelEncoding;}
+
+	bool useBatchMessages() const {return mUseBatchMessages;}
+
+	bool attached() const {return mAttached;}
+
+	int subscriberCount() const {return mSubscriberCount;}
+
+	/// Entire model data as a JSON message
+	/** Same as sent by sendEntireData(), but returned instead of broadcast. Use this to send
+		a snapshot to a single new client. */
+	QByteArray entireDataMessage();
+
+	ModelStore* store() const {return mStore;}
+
+	/// Persist all messages in a store
+	/** Every message then carries a "sequence" number and the store's "epoch", and is
+		appended to the store's log.
+		The store's periodic snapshots are written from here. The store counts as a subscriber,
+		so all changes are logged, also without any clients.
+
+		If the model is not set yet, new clients are served from the store, see
+		catchUpMessages(). The store is not owned. */
+	void setStore(ModelStore* store);
+
+	/// Messages to bring a new client up to date
+	/** Usually just a snapshot. With a store, a client that knows the data up to a sequence
+		number gets the logged changes since then instead, if they are still available and the
+		epoch matches. Without a model, the stored snapshot and changes are used.
+		@param knownSequence Sequence number of the last message the client got, or -1
+		@param knownEpoch "epoch" of that message */
+	QByteArrayList catchUpMessages(qint64 knownSequence = -1, const QString& knownEpoch = QString());
+
+	/// One message with the given messages followed by the current data of the given rows
+	/** Brings a client that missed some changes up to date, see ChangeConflator. Stamped with
+		the current "sequence" when using a store. Row based protocol only. */
+	QByteArray updateMessage(const QByteArrayList& messages, const QVector<QPair<int, int>>& changedRows);
+
+	/// Apply a JSON message from a client and return the reply to it
+	/** Like receiveMessage(), but the reply is returned instead of emitted with sendReply().
+		A message carrying an "id" is answered with an "ack" or "error" message with the same
+		"id", others get an empty reply.
+
+		Besides the single "changeData", "remove" and "insert" operations, a "transaction"
+		carries several of them in an "operations" array. They are applied in order and
+		submitted once, and the resulting changes are sent together, as a single "batch"
+		message if useBatchMessages is enabled. The
+		transaction stops at the first failing operation, but the operations before it are
+		not undone. */
+	QByteArray handleMessage(const QByteArray& message);
+
+	/// An "ack" message, or an "error" message if error is not empty
+	static QByteArray replyMessage(const QJsonValue& id, const QString& error = QString());
+
 	void setVariantToJsonValueFunction(std::function<QJsonValue (const QVariant&)> variantToJsonValueFunction) {mVariantToJsonValueFunction = variantToJsonValueFunction;}
 	void setJsonValueToVariantFunction(std::function<QVariant (const QJsonValue&)> jsonValueToVariantFunction) {mJsonValueToVariantFunction = jsonValueToVariantFunction;}
 
 Q_SIGNALS:
 	/// Send message to client
-	/** QString variant.
+	/** QString variant. Only emitted if connected, since converting the encoded message costs
+		an allocation and a copy per message.
 		@see sendMessageAsByteArray() */
 	void sendMessageAsString(const QString& message);
 
@@ -108,6 +204,16 @@ Q_SIGNALS:
 		@see sendMessageAsString() */
 	void sendMessageAsByteArray(const QByteArray& message);
 
+	/// A change was sent
+	/** Only emitted with the row based protocol, for receivers that conflate changes instead of
+		forwarding every message, see ChangeConflator.
+		@param message The encoded message for RowsInserted and RowsRemoved, otherwise empty */
+	void changeSent(qtmodelserver::JsonViewModel::Change change, int start, int end, const QByteArray& message);
+
+	/// Reply to the client whose message was handled by receiveMessage()
+	/** @see handleMessage() */
+	void sendReply(const QByteArray& reply);
+
 	void modelChanged(QAbstractItemModel* model);
 
 	void keyItemChanged(int keyItem);
@@ -118,18 +224,31 @@ Q_SIGNALS:
 
 	void cacheRoleNamesChanged(bool cacheRoleNames);
 
+	void parallelEncodingChanged(bool parallelEncoding);
+
+	void useBatchMessagesChanged(bool useBatchMessages);
+
+	void attachedChanged(bool attached);
+
+	void subscriberCountChanged(int subscriberCount);
+
 public Q_SLOTS:
 	/// Send entire model data as a JSON message
 	/** Call this e.g. when a new client connects. */
 	void sendEntireData();
 
+	/// Send a message that was encoded elsewhere
+	/** E.g. a message from an upstream server that is relayed verbatim. */
+	void forwardMessage(const QByteArray& message);
+
 	/// Handle JSON message from client
 	/** QString overload. */
 	void receiveMessage(const QString& message);
 
 	/// Handle JSON message from client
 	/** QByteArray overload. Prefer this over QString since QByteArray is the native format
-		of the Qt JSON serializer.*/
+		of the Qt JSON serializer.
+		@see handleMessage() */
 	void receiveMessage(const QByteArray& message);
 
 	void setModel(QAbstractItemModel* model);
@@ -142,36 +261,142 @@ public Q_SLOTS:
 
 	void setCacheRoleNames(bool cacheRoleNames);
 
+	void setParallelEncoding(bool parallelEncoding);
+
+	void setUseBatchMessages(bool useBatchMessages);
+
+	void setAttached(bool attached);
+
+	/// Register a client
+	/** The first subscriber attaches to the model, so the client should be sent a fresh
+		snapshot (see entireDataMessage()) afterwards. Calls must be balanced with
+		unsubscribe(). */
+	void subscribe();
+
+	/// Unregister a client
+	/** The last subscriber leaving detaches from the model, so model changes do not cause any
+		model reads or JSON encoding until the next subscribe(). */
+	void unsubscribe();
+
 protected Q_SLOTS:
+	/// Write the current model data to the store
+	void writeSnapshot();
+
 	void dataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector<int>& roles = QVector<int>());
 	void rowsAboutToBeRemoved(const QModelIndex& parent, int start, int end);
 	void rowsInserted(const QModelIndex& parent, int start, int end);
 	void modelReset();
 
 private:
-	QJsonObject fetchRows(int start, int end);
-	QJsonArray fetchRowsAsArray(int start, int end);
-	QJsonObject fetchRowRoles(const QModelIndex& index, bool includeKeyItem = false);
+	void connectModel();
+	void disconnectModel();
+
+	/// Refresh cached role names, header data and keys from the model
+	void updateModelInfo();
+
+	/// A message to clients, with the items already encoded
+	struct Message
+	{
+		const char* operation = nullptr;
+		QByteArray items; ///< JSON array or object, omitted if empty
+		int start = -1; ///< Rows of the row based protocol, omitted if negative
+		int end = -1;
+		QString key; ///< Key name, only for "rowData"
+	};
+
+	/// An attribute of the items with its encoded name
+	struct Field
+	{
+		int item; ///< Role or column
+		QByteArray encodedName;
+	};
+
+	Message entireData();
+
+	/// Encode the items of the given rows into mItemsBuffer
+	/** @return Refers to mItemsBuffer, so it is only valid until the next call */
+	QByteArray encodeRows(int start, int end);
+	void writeRows(JsonWriter& writer, int start, int end);
+
+	/// Write the given rows as array elements
+	/** Thread-safe if the model is. */
+	void writeRowItems(JsonWriter& writer, const QVector<Field>& fields, int start, int end) const;
+	void writeItem(JsonWriter& writer, const QVector<Field>& fields, int row) const;
+
+	/// Like writeRowItems(), but split into ranges that are encoded in parallel
+	/** The calling thread takes part, so this also finishes while the thread pool is busy. */
+	void writeRowItemsInParallel(JsonWriter& writer, const QVector<Field>& fields, int start, int end) const;
+	/// Encode the names of the item attributes into mFields
+	void updateFields();
+
 	void setItemData(int row, const QJsonObject& item);
 
+	/// Apply a single operation without submitting
+	/** @return Error message, empty on success */
+	QString applyOperation(const QJsonObject& object);
+
+	/// Apply the operations of a transaction and send the changes as one message
+	/** @return Error message, empty on success */
+	QString applyTransaction(const QJsonObject& object);
+
 	/// Returns key header or role name
 	QString keyName() const {return mUseColumns ? mHeaderData[mKeyItem] : mRoleNames[mKeyItem];}
 
 	/** @see mKeyToRowCache */
 	int getRowForKey(const QString& key);
 
-	void sendMessage(const QJsonDocument& document);
+	/// Whether any of the sendMessage signals is connected, or a store is set
+	/** Nothing is read from the model or encoded while this is false. */
+	bool hasReceivers() const;
+
+	/// Encode, log and send a message
+	/** Collected in mBatch instead during a transaction. */
+	void sendMessage(const Message& message);
+
+	/// Log and send an encoded message
+	void send(const QByteArray& data);
+
+	/// Emit changeSent() if connected
+	/** @param data The encoded message, or empty to encode it here if needed */
+	void reportChange(const Message& message, const QByteArray& data);
+
+	/// Encode a message into mBuffer and return a copy of exactly its size
+	/** @param sequence Omitted if negative */
+	QByteArray encodeMessage(const Message& message, qint64 sequence);
+	/// Encode a "batch" message
+	/** @param encodedMessages Put before the messages of the batch */
+	QByteArray encodeBatch(const QVector<Message>& batch, qint64 sequence, const QByteArrayList& encodedMessages = QByteArrayList());
+	/// Write the "sequence" and "epoch" keys, when using a store
+	void writeSequence(JsonWriter& writer, qint64 sequence);
+	static void writeMessage(JsonWriter& writer, const Message& message);
+
+	/// Fold a change message into the previous one of a batch
+	/** Only changes to the same or directly following rows are merged. */
+	static bool mergeChange(Message& previous, const Message& next);
 
 	QAbstractItemModel* m_model = nullptr;
 
 	QHash<int, QByteArray> mRoleNames;
 	QHash<int, QString> mHeaderData;
+	QVector<Field> mFields; ///< Attributes written per item, empty if outdated
 	QHash<QString, int> mKeyToRowCache;
 	QVector<QString> mRowKeys;
 	int mKeyItem = 0;
 	bool mUseColumns = false;
 	bool mUseRowBasedProtocol = true;
 	bool mCacheRoleNames = true;
+	bool mParallelEncoding = false;
+	bool mUseBatchMessages = false;
+	bool mAttached = true;
+	int mSubscriberCount = 0;
+	ModelStore* mStore = nullptr;
+	quint64 mSequence = 0; ///< Of the last message, when using a store
+	int mBatchDepth = 0; ///< Messages are collected in mBatch while > 0
+	QVector<Message> mBatch;
+
+	// Reused for encoding, so messages don't cause any allocations besides the final copy:
+	QByteArray mBuffer;
+	QByteArray mItemsBuffer;
 
 	std::function<QJsonValue (const QVariant&)> mVariantToJsonValueFunction;
 	std::function<QVariant (const QJsonValue&)> mJsonValueToVariantFunction;
@@ -0,0 +1,335 @@
+/* JsonWriter.cpp
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "JsonWriter.h"
+#include <QJsonValue>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QLocale>
+#include <QString>
+
+#include <cmath>
+#include <cstring>
+
+namespace qtmodelserver
+{
+
+void JsonWriter::beginObject()
+{
+	separate();
+	mBuffer.append('{');
+	mHasElements.append(false);
+}
+
+void JsonWriter::endObject()
+{
+	Q_ASSERT(!mHasElements.isEmpty() && !mAfterKey);
+	mHasElements.removeLast();
+	mBuffer.append('}');
+}
+
+void JsonWriter::beginArray()
+{
+	separate();
+	mBuffer.append('[');
+	mHasElements.append(false);
+}
+
+void JsonWriter::endArray()
+{
+	Q_ASSERT(!mHasElements.isEmpty() && !mAfterKey);
+	mHasElements.removeLast();
+	mBuffer.append(']');
+}
+
+void JsonWriter::key(const char* name)
+{
+	separate();
+	writeString(name, int(std::strlen(name)));
+	mBuffer.append(':');
+	mAfterKey = true;
+}
+
+void JsonWriter::key(const QByteArray& name)
+{
+	separate();
+	writeString(name.constData(), name.size());
+	mBuffer.append(':');
+	mAfterKey = true;
+}
+
+void JsonWriter::key(const QString& name)
+{
+	separate();
+	writeString(name);
+	mBuffer.append(':');
+	mAfterKey = true;
+}
+
+void JsonWriter::encodedKey(const QByteArray& encodedKey)
+{
+	separate();
+	mBuffer.append(encodedKey);
+	mAfterKey = true;
+}
+
+void JsonWriter::value(const QJsonValue& value)
+{
+	switch(value.type())
+	{
+	case QJsonValue::Bool:
+		this->value(value.toBool());
+		break;
+	case QJsonValue::Double:
+		this->value(value.toDouble());
+		break;
+	case QJsonValue::String:
+		this->value(value.toString());
+		break;
+	case QJsonValue::Array:
+		writeArray(value.toArray());
+		break;
+	case QJsonValue::Object:
+		writeObject(value.toObject());
+		break;
+	default:
+		nullValue();
+	}
+}
+
+void JsonWriter::value(const QString& value)
+{
+	separate();
+	writeString(value);
+}
+
+void JsonWriter::value(const char* value)
+{
+	separate();
+	writeString(value, int(std::strlen(value)));
+}
+
+void JsonWriter::value(qint64 value)
+{
+	separate();
+
+	// Without a temporary QByteArray:
+	char digits[24];
+	char* end = digits + sizeof(digits);
+	char* begin = end;
+	quint64 magnitude = value < 0 ? 0 - quint64(value) : quint64(value);
+	do
+	{
+		*--begin = char('0' + magnitude % 10);
+		magnitude /= 10;
+	} while(magnitude > 0);
+	if(value < 0)
+		*--begin = '-';
+	mBuffer.append(begin, int(end - begin));
+}
+
+void JsonWriter::value(double value)
+{
+	if(!std::isfinite(value))
+	{
+		nullValue(); // Like QJsonDocument
+		return;
+	}
+
+	// Integers are common and cheap to write:
+	const double maxExactInteger = 9007199254740992.0; // 2^53
+	if(value == std::floor(value) && std::fabs(value) < maxExactInteger)
+	{
+		this->value(qint64(value));
+		return;
+	}
+
+	separate();
+	mBuffer.append(QByteArray::number(value, 'g', QLocale::FloatingPointShortest));
+}
+
+void JsonWriter::value(bool value)
+{
+	separate();
+	mBuffer.append(value ? "true" : "false");
+}
+
+void JsonWriter::nullValue()
+{
+	separate();
+	mBuffer.append("null");
+}
+
+void JsonWriter::rawValue(const QByteArray& json)
+{
+	separate();
+	mBuffer.append(json);
+}
+
+QByteArray JsonWriter::encodeKey(const QByteArray& name)
+{
+	QByteArray encoded;
+	JsonWriter writer(encoded);
+	writer.writeString(name.constData(), name.size());
+	encoded.append(':');
+	return encoded;
+}
+
+void JsonWriter::separate()
+{
+	if(mAfterKey)
+	{
+		mAfterKey = false;
+		return;
+	}
+	if(mHasElements.isEmpty())
+		return;
+	if(mHasElements.last())
+		mBuffer.append(',');
+	mHasElements.last() = true;
+}
+
+void JsonWriter::writeString(const char* data, int size)
+{
+	mBuffer.append('"');
+	int runStart = 0;
+	for(int i = 0; i < size; ++i)
+	{
+		const unsigned char c = static_cast<unsigned char>(data[i]);
+		if(c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		// Copy the unescaped run in one go, then the escape sequence:
+		mBuffer.append(data + runStart, i - runStart);
+		runStart = i + 1;
+		writeEscape(c);
+	}
+	mBuffer.append(data + runStart, size - runStart);
+	mBuffer.append('"');
+}
+
+void JsonWriter::writeString(const QString& string)
+{
+	// Converted to UTF-8 on the way, without a temporary QByteArray:
+	const QChar* data = string.constData();
+	const int size = string.size();
+	mBuffer.append('"');
+	int runStart = 0;
+	for(int i = 0; i < size; ++i)
+	{
+		const ushort c = data[i].unicode();
+		if(c >= 0x20 && c < 0x80 && c != '"' && c != '\\')
+			continue;
+
+		// Copy the ASCII run in one go, then the escaped or multi-byte character:
+		appendAscii(data + runStart, i - runStart);
+		runStart = i + 1;
+
+		char utf8[4];
+		if(c < 0x80)
+			writeEscape(static_cast<unsigned char>(c));
+		else if(c < 0x800)
+		{
+			utf8[0] = char(0xc0 | (c >> 6));
+			utf8[1] = char(0x80 | (c & 0x3f));
+			mBuffer.append(utf8, 2);
+		}
+		else if(QChar::isHighSurrogate(c) && i + 1 < size && data[i + 1].isLowSurrogate())
+		{
+			const uint codePoint = QChar::surrogateToUcs4(c, data[i + 1].unicode());
+			utf8[0] = char(0xf0 | (codePoint >> 18));
+			utf8[1] = char(0x80 | ((codePoint >> 12) & 0x3f));
+			utf8[2] = char(0x80 | ((codePoint >> 6) & 0x3f));
+			utf8[3] = char(0x80 | (codePoint & 0x3f));
+			mBuffer.append(utf8, 4);
+			runStart = ++i + 1;
+		}
+		else
+		{
+			const ushort unit = QChar::isSurrogate(c) ? ushort(QChar::ReplacementCharacter) : c; // Unpaired
+			utf8[0] = char(0xe0 | (unit >> 12));
+			utf8[1] = char(0x80 | ((unit >> 6) & 0x3f));
+			utf8[2] = char(0x80 | (unit & 0x3f));
+			mBuffer.append(utf8, 3);
+		}
+	}
+	appendAscii(data + runStart, size - runStart);
+	mBuffer.append('"');
+}
+
+void JsonWriter::appendAscii(const QChar* data, int size)
+{
+	const int offset = mBuffer.size();
+	mBuffer.resize(offset + size);
+	char* out = mBuffer.data() + offset;
+	for(int i = 0; i < size; ++i)
+		out[i] = char(data[i].unicode());
+}
+
+void JsonWriter::writeEscape(unsigned char c)
+{
+	static const char hexDigits[] = "0123456789abcdef";
+
+	switch(c)
+	{
+	case '"': mBuffer.append("\\\""); break;
+	case '\\': mBuffer.append("\\\\"); break;
+	case '\b': mBuffer.append("\\b"); break;
+	case '\f': mBuffer.append("\\f"); break;
+	case '\n': mBuffer.append("\\n"); break;
+	case '\r': mBuffer.append("\\r"); break;
+	case '\t': mBuffer.append("\\t"); break;
+	default:
+	{
+		const char escape[] = {'\\', 'u', '0', '0', hexDigits[c >> 4], hexDigits[c & 0xf]};
+		mBuffer.append(escape, int(sizeof(escape)));
+	}
+	}
+}
+
+void JsonWriter::writeObject(const QJsonObject& object)
+{
+	beginObject();
+	for(auto it = object.begin(); it != object.end(); ++it)
+	{
+		key(it.key());
+		value(it.value());
+	}
+	endObject();
+}
+
+void JsonWriter::writeArray(const QJsonArray& array)
+{
+	beginArray();
+	for(const QJsonValue& element: array)
+		value(element);
+	endArray();
+}
+
+} // namespace qtmodelserver
@@ -0,0 +1,98 @@
+/* JsonWriter.h
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef QTMODELSERVER_JSONWRITER_H
+#define QTMODELSERVER_JSONWRITER_H
+
+#include <QByteArray>
+#include <QVarLengthArray>
+
+class QJsonValue;
+class QJsonObject;
+class QJsonArray;
+class QString;
+
+namespace qtmodelserver
+{
+
+/// Appends compact JSON to a QByteArray
+/** Writes values as they come, without building a QJsonObject or QJsonDocument first, so
+	messages can be encoded into a reused buffer. Commas are inserted automatically. The
+	caller is responsible for balancing begin and end calls, and for calling key() before each
+	value inside an object. */
+class JsonWriter
+{
+public:
+	explicit JsonWriter(QByteArray& buffer) : mBuffer(buffer) {}
+
+	void beginObject();
+	void endObject();
+	void beginArray();
+	void endArray();
+
+	/// Write an object key
+	void key(const char* name);
+	void key(const QByteArray& name);
+	void key(const QString& name);
+
+	/// Write an object key that was already encoded by encodeKey()
+	void encodedKey(const QByteArray& encodedKey);
+
+	void value(const QJsonValue& value);
+	void value(const QString& value);
+	void value(const char* value);
+	void value(qint64 value);
+	void value(int value) {this->value(qint64(value));}
+	void value(double value);
+	void value(bool value);
+	void nullValue();
+
+	/// Write JSON that was encoded elsewhere, e.g. by another JsonWriter
+	void rawValue(const QByteArray& json);
+
+	/// Encode an object key including the colon, for encodedKey()
+	static QByteArray encodeKey(const QByteArray& name);
+
+private:
+	void separate();
+	void writeString(const char* data, int size);
+	void writeString(const QString& string);
+	void appendAscii(const QChar* data, int size);
+	void writeEscape(unsigned char c);
+	void writeObject(const QJsonObject& object);
+	void writeArray(const QJsonArray& array);
+
+	QByteArray& mBuffer;
+	QVarLengthArray<bool, 8> mHasElements; ///< Per nesting level
+	bool mAfterKey = false;
+};
+
+} // namespace qtmodelserver
+
+#endif // QTMODELSERVER_JSONWRITER_H
@@ -0,0 +1,221 @@
+/* ModelStore.cpp
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ModelStore.h"
+#include <QSaveFile>
+#include <QTimer>
+#include <QtEndian>
+#include <QUuid>
+#include <QDebug>
+
+#include <cstring>
+
+namespace qtmodelserver
+{
+
+namespace
+{
+const char snapshotMagic[4] = {'Q', 'M', 'S', '1'};
+const int snapshotHeaderSize = 12; // Magic, sequence number
+const int logHeaderSize = 12; // Sequence number, size
+}
+
+ModelStore::ModelStore(const QString& fileName, QObject* parent) :
+	QObject(parent),
+	mSnapshotFileName(fileName),
+	mLogFile(fileName + QStringLiteral(".log")),
+	mSnapshotTimer(new QTimer(this))
+{
+	mSnapshotTimer->setInterval(60000);
+	connect(mSnapshotTimer, &QTimer::timeout, this, &ModelStore::snapshotDue);
+}
+
+bool ModelStore::open()
+{
+	readSnapshot();
+
+	if(!mLogFile.open(QIODevice::ReadWrite | QIODevice::Append))
+	{
+		qWarning() << "Could not open" << mLogFile.fileName() << mLogFile.errorString();
+		return false;
+	}
+	loadLog();
+
+	// Whatever was logged before may have lost its end, so numbers from then can't be trusted:
+	mEpoch = QString::fromLatin1(QUuid::createUuid().toRfc4122().toHex());
+
+	if(mSnapshotTimer->interval() > 0)
+		mSnapshotTimer->start();
+	return true;
+}
+
+QByteArrayList ModelStore::messagesSince(quint64 sequence)
+{
+	QByteArrayList messages;
+	if(sequence < mLogStartSequence || sequence > mSequence)
+		return messages;
+
+	for(int i = int(sequence - mLogStartSequence); i < mLogOffsets.size(); ++i)
+	{
+		char header[logHeaderSize];
+		if(!mLogFile.seek(mLogOffsets.at(i)) || mLogFile.read(header, logHeaderSize) != logHeaderSize)
+		{
+			qWarning() << "Could not read" << mLogFile.fileName() << mLogFile.errorString();
+			return QByteArrayList();
+		}
+		const quint32 size = qFromBigEndian<quint32>(header + 8);
+		messages.append(mLogFile.read(size));
+	}
+	return messages;
+}
+
+void ModelStore::setSnapshotInterval(int snapshotInterval)
+{
+	mSnapshotTimer->setInterval(snapshotInterval);
+	if(snapshotInterval <= 0)
+		mSnapshotTimer->stop();
+	else if(mLogFile.isOpen())
+		mSnapshotTimer->start();
+}
+
+void ModelStore::append(quint64 sequence, const QByteArray& message)
+{
+	if(sequence != mSequence + 1)
+	{
+		// Logging it would leave a gap that no snapshot covers. A new snapshot makes it whole again:
+		qWarning() << "Rejecting non-consecutive sequence number" << sequence << "after" << mSequence;
+		Q_EMIT snapshotDue();
+		return;
+	}
+
+	char header[logHeaderSize];
+	qToBigEndian<quint64>(sequence, header);
+	qToBigEndian<quint32>(quint32(message.size()), header + 8);
+
+	const qint64 offset = mLogFile.size();
+	if(mLogFile.write(header, logHeaderSize) != logHeaderSize || mLogFile.write(message) != message.size() || !mLogFile.flush())
+	{
+		qWarning() << "Could not write" << mLogFile.fileName() << mLogFile.errorString();
+		return;
+	}
+	mLogOffsets.append(offset);
+	mSequence = sequence;
+}
+
+bool ModelStore::writeSnapshot(quint64 sequence, const QByteArray& snapshot)
+{
+	Q_ASSERT(sequence >= mSequence);
+
+	QSaveFile file(mSnapshotFileName);
+	char header[snapshotHeaderSize];
+	std::memcpy(header, snapshotMagic, sizeof(snapshotMagic));
+	qToBigEndian<quint64>(sequence, header + 4);
+	if(!file.open(QIODevice::WriteOnly) || file.write(header, snapshotHeaderSize) != snapshotHeaderSize || file.write(snapshot) != snapshot.size())
+	{
+		qWarning() << "Could not write" << file.fileName() << file.errorString();
+		return false;
+	}
+
+	if(!file.commit())
+	{
+		qWarning() << "Could not write" << file.fileName() << file.errorString();
+		return false;
+	}
+	mSnapshot = snapshot;
+
+	truncateLog(sequence);
+	return true;
+}
+
+void ModelStore::readSnapshot()
+{
+	QFile file(mSnapshotFileName);
+	if(!file.exists())
+		return;
+	if(!file.open(QIODevice::ReadOnly))
+	{
+		qWarning() << "Could not open" << file.fileName() << file.errorString();
+		return;
+	}
+
+	char header[snapshotHeaderSize];
+	if(file.read(header, snapshotHeaderSize) != snapshotHeaderSize || std::memcmp(header, snapshotMagic, sizeof(snapshotMagic)) != 0)
+	{
+		qWarning() << "Invalid snapshot file" << file.fileName();
+		return;
+	}
+
+	mSnapshot = file.readAll();
+	mLogStartSequence = qFromBigEndian<quint64>(header + 4);
+	mSequence = qMax(mSequence, mLogStartSequence);
+}
+
+void ModelStore::loadLog()
+{
+	mLogOffsets.clear();
+	mSequence = mLogStartSequence;
+
+	// Entries up to the snapshot can be left over from a crash while taking the snapshot
+	const qint64 fileSize = mLogFile.size();
+	qint64 offset = 0;
+	while(offset + logHeaderSize <= fileSize)
+	{
+		char header[logHeaderSize];
+		if(!mLogFile.seek(offset) || mLogFile.read(header, logHeaderSize) != logHeaderSize)
+			break;
+		const quint64 sequence = qFromBigEndian<quint64>(header);
+		const quint32 size = qFromBigEndian<quint32>(header + 8);
+		if(offset + logHeaderSize + size > fileSize)
+			break; // Incomplete entry
+		if(sequence > mSequence)
+		{
+			if(sequence != mSequence + 1)
+				break; // Gap
+			mLogOffsets.append(offset);
+			mSequence = sequence;
+		}
+		offset += logHeaderSize + size;
+	}
+
+	if(offset < fileSize)
+	{
+		qWarning() << "Discarding damaged end of" << mLogFile.fileName();
+		mLogFile.resize(offset);
+	}
+}
+
+void ModelStore::truncateLog(quint64 startSequence)
+{
+	mLogFile.resize(0);
+	mLogOffsets.clear();
+	mLogStartSequence = startSequence;
+	mSequence = startSequence;
+}
+
+} // namespace qtmodelserver
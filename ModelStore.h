@@ -0,0 +1,128 @@
+/* ModelStore.h
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef QTMODELSERVER_MODELSTORE_H
+#define QTMODELSERVER_MODELSTORE_H
+
+#include <QObject>
+#include <QFile>
+#include <QVector>
+#include <QByteArrayList>
+
+class QTimer;
+
+namespace qtmodelserver
+{
+
+/// Durable snapshot and change log of a JsonViewModel
+/** Consists of a snapshot file holding an encoded snapshot message, and an append-only log
+	file (file name + ".log") holding all messages sent since the snapshot was taken. Messages
+	are numbered with consecutive sequence numbers. The snapshot is read once when opening, and
+	kept in memory, so a restarted server can serve it right away.
+
+	Writing a new snapshot truncates the log, so clients can resume from any sequence number
+	since the last snapshot.
+
+	The log is flushed but not synced to disk, so a crash can cut off its end, and the files
+	can be deleted. Sequence numbers handed out before may then be reused for other changes.
+	Every opening of the store therefore draws a random epoch(), and clients can only resume
+	with a sequence number from the same epoch.
+	@see JsonViewModel::setStore() */
+class ModelStore : public QObject
+{
+	Q_OBJECT
+public:
+	explicit ModelStore(const QString& fileName, QObject* parent = nullptr);
+
+	/// Open or create the files and load what was stored before
+	bool open();
+
+	QString fileName() const {return mSnapshotFileName;}
+
+	bool hasSnapshot() const {return !mSnapshot.isNull();}
+
+	/// Stored snapshot message
+	/** Shared with all callers, and with the caller of writeSnapshot(). */
+	QByteArray snapshot() const {return mSnapshot;}
+
+	quint64 snapshotSequence() const {return mLogStartSequence;}
+
+	/// Random id of the sequence numbers handed out since the store was opened
+	QString epoch() const {return mEpoch;}
+
+	/// Sequence number of the last stored message
+	quint64 sequence() const {return mSequence;}
+
+	/// Whether messagesSince() can bring a client with the given epoch and sequence number up to date
+	bool canResume(const QString& epoch, quint64 sequence) const
+	{
+		return !mEpoch.isEmpty() && epoch == mEpoch && sequence >= mLogStartSequence && sequence <= mSequence;
+	}
+
+	/// Logged messages after the given sequence number
+	QByteArrayList messagesSince(quint64 sequence);
+
+	/// Interval for snapshotDue() in milliseconds
+	/** Default is one minute. 0 disables periodic snapshots. */
+	void setSnapshotInterval(int snapshotInterval);
+
+Q_SIGNALS:
+	/// Time to call writeSnapshot()
+	void snapshotDue();
+
+public Q_SLOTS:
+	/// Append a message to the log
+	/** Sequence numbers must be consecutive. Otherwise the message is not logged, and
+		snapshotDue() is emitted right away, since only a new snapshot covers the gap. */
+	void append(quint64 sequence, const QByteArray& message);
+
+	/// Replace the snapshot and truncate the log
+	/** The snapshot must include all changes up to the given sequence number. */
+	bool writeSnapshot(quint64 sequence, const QByteArray& snapshot);
+
+private:
+	void readSnapshot();
+	void loadLog();
+	void truncateLog(quint64 startSequence);
+
+	QString mSnapshotFileName;
+	QByteArray mSnapshot;
+
+	QFile mLogFile;
+	QVector<qint64> mLogOffsets; ///< Entry i has sequence number mLogStartSequence + 1 + i
+	quint64 mLogStartSequence = 0;
+	quint64 mSequence = 0;
+	QString mEpoch;
+
+	QTimer* mSnapshotTimer;
+};
+
+} // namespace qtmodelserver
+
+#endif // QTMODELSERVER_MODELSTORE_H
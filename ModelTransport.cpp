@@ -0,0 +1,124 @@
+/* ModelTransport.cpp
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ModelTransport.h"
+
+namespace qtmodelserver
+{
+
+ModelTransport::ModelTransport(QObject* parent) :
+	QObject(parent)
+{
+
+}
+
+ModelTransport::~ModelTransport()
+{
+	// Connections are usually children and deleted after this, so don't get notified about it:
+	for(auto it = mClientIds.constBegin(); it != mClientIds.constEnd(); ++it)
+		disconnect(it.key(), nullptr, this, nullptr);
+}
+
+void ModelTransport::acceptClient(quint64 clientId, const QByteArrayList& messages)
+{
+	auto it = mClients.constFind(clientId);
+	if(it == mClients.constEnd())
+		return; // Disconnected in the meantime
+
+	for(const QByteArray& message : messages)
+		writeMessage(it->connection, message);
+	mAcceptedConnections[it->path].append(it->connection);
+}
+
+void ModelTransport::sendToPath(const QString& path, const QByteArray& message)
+{
+	const QVector<QObject*> connections = acceptedConnections(path);
+	for(QObject* connection : connections)
+		writeMessage(connection, message);
+}
+
+void ModelTransport::sendToClient(quint64 clientId, const QByteArray& message)
+{
+	auto it = mClients.constFind(clientId);
+	if(it != mClients.constEnd())
+		writeMessage(it->connection, message);
+}
+
+void ModelTransport::closeClient(quint64 clientId)
+{
+	QObject* connection = takeClient(clientId);
+	if(connection)
+		closeConnection(connection);
+}
+
+quint64 ModelTransport::addClient(QObject* connection, const QString& path, const QString& query)
+{
+	const quint64 clientId = mNextClientId++;
+	mClients.insert(clientId, Client{connection, path});
+	mClientIds.insert(connection, clientId);
+	Q_EMIT clientConnected(clientId, path, query);
+	return clientId;
+}
+
+quint64 ModelTransport::addClientForResource(QObject* connection, const QString& resource)
+{
+	const int queryStart = resource.indexOf(QLatin1Char('?'));
+	if(queryStart < 0)
+		return addClient(connection, resource);
+	return addClient(connection, resource.left(queryStart), resource.mid(queryStart + 1));
+}
+
+void ModelTransport::removeClient(quint64 clientId)
+{
+	if(takeClient(clientId))
+		Q_EMIT clientDisconnected(clientId);
+}
+
+QObject* ModelTransport::takeClient(quint64 clientId)
+{
+	auto it = mClients.find(clientId);
+	if(it == mClients.end())
+		return nullptr;
+
+	QObject* connection = it->connection;
+	auto pathIt = mAcceptedConnections.find(it->path);
+	if(pathIt != mAcceptedConnections.end())
+	{
+		pathIt->removeOne(connection);
+		if(pathIt->isEmpty())
+			mAcceptedConnections.erase(pathIt);
+	}
+	mClients.erase(it);
+	mClientIds.remove(connection);
+
+	disconnect(connection, nullptr, this, nullptr);
+	return connection;
+}
+
+} // namespace qtmodelserver
@@ -0,0 +1,125 @@
+/* ModelTransport.h
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef QTMODELSERVER_MODELTRANSPORT_H
+#define QTMODELSERVER_MODELTRANSPORT_H
+
+#include <QObject>
+#include <QHash>
+#include <QVector>
+#include <QByteArrayList>
+
+namespace qtmodelserver
+{
+
+/// Connection handling between WebSocketModelServer and its clients
+/** A transport accepts connections, reports them to the server together with the path they
+	requested, and delivers messages in both directions. Subscriptions, encoding and everything
+	else about the protocol is done by the server, so all transports behave the same.
+
+	Clients are referred to by ID only, so a transport can live in another thread than the
+	server. Subclasses implement writeMessage() and closeConnection() and call addClient() and
+	removeClient() as connections come and go. */
+class ModelTransport : public QObject
+{
+	Q_OBJECT
+public:
+	explicit ModelTransport(QObject* parent = nullptr);
+	~ModelTransport();
+
+	/// First client ID to use
+	/** Set by WebSocketModelServer to make client IDs unique across transports. */
+	void setClientIdBase(quint64 base) {mNextClientId = base + 1;}
+
+Q_SIGNALS:
+	/// A client connected to the given path
+	/** The client does not receive any messages until the server calls acceptClient().
+		@param query Query part of the requested URL, without "?" */
+	void clientConnected(quint64 clientId, const QString& path, const QString& query);
+
+	/// A client closed its connection
+	void clientDisconnected(quint64 clientId);
+
+	void messageReceived(quint64 clientId, const QByteArray& message);
+
+public Q_SLOTS:
+	/// Send the initial messages to a client and start sending updates for its path
+	/** Usually just a snapshot. */
+	void acceptClient(quint64 clientId, const QByteArrayList& messages);
+
+	/// Send a message to all accepted clients of a path
+	virtual void sendToPath(const QString& path, const QByteArray& message);
+
+	void sendToClient(quint64 clientId, const QByteArray& message);
+
+	/// Close a client connection without emitting clientDisconnected()
+	void closeClient(quint64 clientId);
+
+protected:
+	/// Register a new connection and emit clientConnected()
+	quint64 addClient(QObject* connection, const QString& path, const QString& query = QString());
+
+	/// Register a new connection to a path, optionally followed by "?" and a query
+	quint64 addClientForResource(QObject* connection, const QString& resource);
+
+	/// Forget a connection closed by the client and emit clientDisconnected()
+	/** Does not delete the connection. */
+	void removeClient(quint64 clientId);
+
+	/// @return ID of a registered connection, or 0
+	quint64 clientId(QObject* connection) const {return mClientIds.value(connection);}
+
+	/// Accepted connections of a path
+	/** Returns a shallow copy, so connections can be removed while iterating over it. */
+	QVector<QObject*> acceptedConnections(const QString& path) const {return mAcceptedConnections.value(path);}
+
+	virtual void writeMessage(QObject* connection, const QByteArray& message) = 0;
+
+	/// Close the connection and schedule it for deletion if owned by the transport
+	virtual void closeConnection(QObject* connection) = 0;
+
+private:
+	struct Client
+	{
+		QObject* connection;
+		QString path;
+	};
+
+	/// Forget a client and disconnect its signals from the transport
+	QObject* takeClient(quint64 clientId);
+
+	QHash<quint64, Client> mClients;
+	QHash<QObject*, quint64> mClientIds;
+	QHash<QString, QVector<QObject*>> mAcceptedConnections; ///< By path
+	quint64 mNextClientId = 1;
+};
+
+} // namespace qtmodelserver
+
+#endif // QTMODELSERVER_MODELTRANSPORT_H
@@ -0,0 +1,441 @@
+/* RemoteItemModel.cpp
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "RemoteItemModel.h"
+#include <QWebSocket>
+#include <QJsonDocument>
+#include <QTimer>
+#include <QUrlQuery>
+#include <QDebug>
+
+namespace qtmodelserver
+{
+
+RemoteItemModel::RemoteItemModel(QObject* parent) :
+	QAbstractListModel(parent),
+	mReconnectTimer(new QTimer(this)),
+	mVariantToJsonValueFunction(QJsonValue::fromVariant),
+	mJsonValueToVariantFunction([](const QJsonValue& v){return v.toVariant();})
+{
+	// Same as remote-model.ts:
+	mReconnectTimer->setInterval(5000);
+	mReconnectTimer->setSingleShot(true);
+	connect(mReconnectTimer, &QTimer::timeout, this, &RemoteItemModel::openSocket);
+}
+
+int RemoteItemModel::roleForName(const QString& name) const
+{
+	const int column = mRoleNames.indexOf(name);
+	return column >= 0 ? Qt::UserRole + column : -1;
+}
+
+int RemoteItemModel::rowCount(const QModelIndex& parent) const
+{
+	return parent.isValid() ? 0 : mRowCount;
+}
+
+QVariant RemoteItemModel::data(const QModelIndex& index, int role) const
+{
+	if(!index.isValid() || index.row() >= mRowCount)
+		return QVariant();
+
+	const int column = role == Qt::DisplayRole || role == Qt::EditRole ? mKeyColumn : role - Qt::UserRole;
+	if(column < 0 || column >= mRoleNames.size())
+		return QVariant();
+
+	return mValues.at(index.row() * mRoleNames.size() + column);
+}
+
+QHash<int, QByteArray> RemoteItemModel::roleNames() const
+{
+	QHash<int, QByteArray> roleNames;
+	for(int i = 0; i < mRoleNames.size(); ++i)
+		roleNames.insert(Qt::UserRole + i, mRoleNames.at(i).toUtf8());
+	return roleNames;
+}
+
+bool RemoteItemModel::setData(const QModelIndex& index, const QVariant& value, int role)
+{
+	const int column = role - Qt::UserRole;
+	if(!index.isValid() || index.row() >= mRowCount || column < 0 || column >= mRoleNames.size() || mKeyColumn < 0 || column == mKeyColumn)
+		return false;
+
+	const QString key = rowKey(index.row());
+	QJsonObject& items = pendingKeyedItems(QStringLiteral("changeData"));
+	QJsonObject item = items.value(key).toObject();
+	item.insert(mRoleNames.at(column), mVariantToJsonValueFunction(value));
+	items.insert(key, item);
+	scheduleSubmit();
+	return true;
+}
+
+bool RemoteItemModel::removeRows(int row, int count, const QModelIndex& parent)
+{
+	if(parent.isValid() || row < 0 || count <= 0 || row + count > mRowCount || mKeyColumn < 0)
+		return false;
+
+	QJsonArray& keys = pendingItems(QStringLiteral("remove"));
+	for(int i = row; i < row + count; ++i)
+		keys.append(rowKey(i));
+	scheduleSubmit();
+	return true;
+}
+
+void RemoteItemModel::insertItem(const QVariantMap& item)
+{
+	QJsonObject object;
+	for(auto it = item.begin(); it != item.end(); ++it)
+		object.insert(it.key(), mVariantToJsonValueFunction(it.value()));
+
+	auto keyIt = object.find(mKeyName);
+	if(!mKeyName.isEmpty() && keyIt != object.end())
+	{
+		const QString key = keyIt->isDouble() ? QString::number(keyIt->toDouble()) : keyIt->toString();
+		pendingKeyedItems(QStringLiteral("insert")).insert(key, object);
+	}
+	else
+		pendingItems(QStringLiteral("insert")).append(object);
+	scheduleSubmit();
+}
+
+void RemoteItemModel::receiveMessage(const QByteArray& message)
+{
+	const QJsonDocument document = QJsonDocument::fromJson(message);
+	if(!document.isObject())
+	{
+		qWarning() << "Message is not a JSON object";
+		return;
+	}
+	const QJsonObject object = document.object();
+
+	const QString operation = object.value(QStringLiteral("operation")).toString();
+	if(operation == QLatin1String("ack") || operation == QLatin1String("error"))
+	{
+		mSentRequestIds.remove(qint64(object.value(QStringLiteral("id")).toDouble()));
+		Q_EMIT replyReceived(object.value(QStringLiteral("id")), object.value(QStringLiteral("message")).toString());
+		return;
+	}
+
+	applyOperation(object);
+
+	auto sequenceIt = object.find(QStringLiteral("sequence"));
+	if(sequenceIt != object.end())
+	{
+		mSequence = qint64(sequenceIt->toDouble());
+		mEpoch = object.value(QStringLiteral("epoch")).toString();
+		Q_EMIT sequenceChanged(mSequence);
+	}
+
+	Q_EMIT messageReceived(message);
+}
+
+void RemoteItemModel::sendMessage(const QByteArray& message)
+{
+	if(mSocket && mConnected)
+		mSocket->sendTextMessage(QString::fromUtf8(message));
+	Q_EMIT sendMessageAsByteArray(message);
+}
+
+bool RemoteItemModel::submit()
+{
+	mSubmitScheduled = false;
+
+	QJsonArray operations;
+	for(const PendingOperation& pending : qAsConst(mPendingOperations))
+	{
+		const QJsonValue items = pending.keyed ? QJsonValue(pending.keyedItems) : QJsonValue(pending.items);
+		operations.append(QJsonObject{{QStringLiteral("operation"), pending.operation}, {QStringLiteral("items"), items}});
+	}
+	mPendingOperations.clear();
+
+	if(operations.isEmpty())
+		return true;
+
+	// Several operations go as one transaction, so the server submits them together:
+	QJsonObject object = operations.size() == 1 ? operations.first().toObject() :
+		QJsonObject{{QStringLiteral("operation"), QStringLiteral("transaction")}, {QStringLiteral("operations"), operations}};
+	const qint64 id = ++mLastRequestId;
+	object.insert(QStringLiteral("id"), double(id));
+	sendOperation(object);
+
+	if(mSocket && !mConnected)
+	{
+		// Dropped by sendMessage(). Answered later, so the caller can take lastRequestId() first:
+		QTimer::singleShot(0, this, [this, id](){Q_EMIT replyReceived(double(id), QStringLiteral("Not connected"));});
+	}
+	else if(mSocket)
+		mSentRequestIds.insert(id);
+	return true;
+}
+
+void RemoteItemModel::revert()
+{
+	mPendingOperations.clear();
+}
+
+void RemoteItemModel::setUrl(const QUrl& url)
+{
+	if (mUrl == url)
+		return;
+
+	mUrl = url;
+	mSequence = -1; // Refers to the old server
+	mEpoch.clear();
+	mReconnectTimer->stop();
+	if(mSocket)
+	{
+		disconnect(mSocket, nullptr, this, nullptr);
+		mSocket->abort();
+		mSocket->deleteLater();
+		mSocket = nullptr;
+		setConnected(false);
+	}
+
+	if(mUrl.isValid())
+	{
+		mSocket = new QWebSocket(QString(), QWebSocketProtocol::VersionLatest, this);
+		connect(mSocket, &QWebSocket::textMessageReceived, this, [this](const QString& message){receiveMessage(message.toUtf8());});
+		connect(mSocket, &QWebSocket::binaryMessageReceived, this, &RemoteItemModel::receiveMessage);
+		connect(mSocket, &QWebSocket::connected, this, [this](){setConnected(true);});
+		connect(mSocket, &QWebSocket::disconnected, this, [this]()
+		{
+			setConnected(false);
+			mReconnectTimer->start();
+		});
+		openSocket();
+	}
+
+	Q_EMIT urlChanged(mUrl);
+}
+
+void RemoteItemModel::setAutoSubmit(bool autoSubmit)
+{
+	if (mAutoSubmit == autoSubmit)
+		return;
+
+	mAutoSubmit = autoSubmit;
+	Q_EMIT autoSubmitChanged(mAutoSubmit);
+}
+
+void RemoteItemModel::applyOperation(const QJsonObject& object)
+{
+	const QString operation = object.value(QStringLiteral("operation")).toString();
+	if(operation == QLatin1String("rowData"))
+		applyRowData(object);
+	else if(operation == QLatin1String("rowsInserted"))
+		applyRowsInserted(object);
+	else if(operation == QLatin1String("rowsRemoved"))
+		applyRowsRemoved(object);
+	else if(operation == QLatin1String("rowDataChanged"))
+		applyRowDataChanged(object);
+	else if(operation == QLatin1String("batch"))
+	{
+		const QJsonArray items = object.value(QStringLiteral("items")).toArray();
+		for(const QJsonValue& item: items)
+			applyOperation(item.toObject());
+	}
+	else
+		qWarning() << "Unsupported operation" << operation;
+}
+
+void RemoteItemModel::applyRowData(const QJsonObject& object)
+{
+	const QJsonArray items = object.value(QStringLiteral("items")).toArray();
+
+	beginResetModel();
+	const QString keyName = object.value(QStringLiteral("key")).toString();
+	const bool keyChanged = keyName != mKeyName;
+	mKeyName = keyName;
+	setRoleNames(items.isEmpty() ? QJsonObject() : items.first().toObject());
+	mRowCount = items.size();
+	mValues.clear();
+	mValues.resize(mRowCount * mRoleNames.size());
+	for(int i = 0; i < mRowCount; ++i)
+		setRow(i, items.at(i).toObject());
+	endResetModel();
+
+	if(keyChanged)
+		Q_EMIT keyNameChanged(mKeyName);
+}
+
+void RemoteItemModel::applyRowsInserted(const QJsonObject& object)
+{
+	const QJsonArray items = object.value(QStringLiteral("items")).toArray();
+	const int start = object.value(QStringLiteral("start")).toInt(-1);
+	if(start < 0 || start > mRowCount)
+	{
+		qWarning() << "Invalid start row for insertion:" << start;
+		return;
+	}
+	if(items.isEmpty())
+		return;
+
+	if(mRowCount == 0)
+	{
+		// Roles were not known so far because the model was empty. Changing them needs a reset:
+		beginResetModel();
+		setRoleNames(items.first().toObject());
+		mRowCount = items.size();
+		mValues.resize(mRowCount * mRoleNames.size());
+		for(int i = 0; i < mRowCount; ++i)
+			setRow(i, items.at(i).toObject());
+		endResetModel();
+		return;
+	}
+
+	const int stride = mRoleNames.size();
+	beginInsertRows(QModelIndex(), start, start + items.size() - 1);
+	mValues.insert(start * stride, items.size() * stride, QVariant());
+	mRowCount += items.size();
+	for(int i = 0; i < items.size(); ++i)
+		setRow(start + i, items.at(i).toObject());
+	endInsertRows();
+}
+
+void RemoteItemModel::applyRowsRemoved(const QJsonObject& object)
+{
+	const int start = object.value(QStringLiteral("start")).toInt(-1);
+	const int end = object.value(QStringLiteral("end")).toInt(-1);
+	if(start < 0 || end < start || end >= mRowCount)
+	{
+		qWarning() << "Invalid rows to remove:" << start << end;
+		return;
+	}
+
+	const int stride = mRoleNames.size();
+	beginRemoveRows(QModelIndex(), start, end);
+	mValues.remove(start * stride, (end - start + 1) * stride);
+	mRowCount -= end - start + 1;
+	endRemoveRows();
+}
+
+void RemoteItemModel::applyRowDataChanged(const QJsonObject& object)
+{
+	const QJsonArray items = object.value(QStringLiteral("items")).toArray();
+	const int start = object.value(QStringLiteral("start")).toInt(-1);
+	if(start < 0 || start + items.size() > mRowCount)
+	{
+		qWarning() << "Invalid rows to change:" << start << items.size();
+		return;
+	}
+	if(items.isEmpty())
+		return;
+
+	for(int i = 0; i < items.size(); ++i)
+		setRow(start + i, items.at(i).toObject());
+	Q_EMIT dataChanged(index(start), index(start + items.size() - 1));
+}
+
+void RemoteItemModel::setRoleNames(const QJsonObject& item)
+{
+	mRoleNames = item.keys().toVector(); // Sorted
+	if(mRoleNames.isEmpty() && !mKeyName.isEmpty())
+		mRoleNames.append(mKeyName); // At least keep the key known
+	mKeyColumn = mRoleNames.indexOf(mKeyName);
+}
+
+void RemoteItemModel::setRow(int row, const QJsonObject& item)
+{
+	const int stride = mRoleNames.size();
+	QVariant* values = mValues.data() + row * stride;
+	for(int i = 0; i < stride; ++i)
+		values[i] = mJsonValueToVariantFunction(item.value(mRoleNames.at(i)));
+}
+
+QString RemoteItemModel::rowKey(int row) const
+{
+	Q_ASSERT(mKeyColumn >= 0);
+	return mValues.at(row * mRoleNames.size() + mKeyColumn).toString();
+}
+
+void RemoteItemModel::setConnected(bool connected)
+{
+	if (mConnected == connected)
+		return;
+
+	mConnected = connected;
+	Q_EMIT connectedChanged(mConnected);
+
+	if(!mConnected)
+	{
+		// Same as remote-model.ts, since their replies won't arrive anymore:
+		const QSet<qint64> ids = mSentRequestIds;
+		mSentRequestIds.clear();
+		for(qint64 id : ids)
+			Q_EMIT replyReceived(double(id), QStringLiteral("Connection lost"));
+	}
+}
+
+void RemoteItemModel::openSocket()
+{
+	Q_ASSERT(mSocket);
+
+	QUrl url = mUrl;
+	if(mSequence >= 0)
+	{
+		// Lets the server send only what was missed, if it persists the model:
+		QUrlQuery query(url);
+		query.removeAllQueryItems(QStringLiteral("sequence"));
+		query.removeAllQueryItems(QStringLiteral("epoch"));
+		query.addQueryItem(QStringLiteral("sequence"), QString::number(mSequence));
+		query.addQueryItem(QStringLiteral("epoch"), mEpoch);
+		url.setQuery(query);
+	}
+	mSocket->open(url);
+}
+
+void RemoteItemModel::scheduleSubmit()
+{
+	if(!mAutoSubmit || mSubmitScheduled)
+		return;
+
+	mSubmitScheduled = true;
+	QMetaObject::invokeMethod(this, "submit", Qt::QueuedConnection);
+}
+
+QJsonObject& RemoteItemModel::pendingKeyedItems(const QString& operation)
+{
+	if(mPendingOperations.isEmpty() || mPendingOperations.last().operation != operation || !mPendingOperations.last().keyed)
+		mPendingOperations.append(PendingOperation{operation, true, QJsonObject(), QJsonArray()});
+	return mPendingOperations.last().keyedItems;
+}
+
+QJsonArray& RemoteItemModel::pendingItems(const QString& operation)
+{
+	if(mPendingOperations.isEmpty() || mPendingOperations.last().operation != operation || mPendingOperations.last().keyed)
+		mPendingOperations.append(PendingOperation{operation, false, QJsonObject(), QJsonArray()});
+	return mPendingOperations.last().items;
+}
+
+void RemoteItemModel::sendOperation(const QJsonObject& object)
+{
+	sendMessage(QJsonDocument(object).toJson(QJsonDocument::Compact));
+}
+
+} // namespace qtmodelserver
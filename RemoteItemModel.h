@@ -0,0 +1,222 @@
+/* RemoteItemModel.h
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef QTMODELSERVER_REMOTEITEMMODEL_H
+#define QTMODELSERVER_REMOTEITEMMODEL_H
+
+#include <QAbstractListModel>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QVector>
+#include <QSet>
+#include <QUrl>
+
+#include <functional>
+
+class QWebSocket;
+class QTimer;
+
+namespace qtmodelserver
+{
+
+/// Client side of JsonViewModel as a QAbstractItemModel
+/** Mirrors a model served by WebSocketModelServer, like remote-model.ts does for Javascript.
+	Only the row based protocol is supported. Every attribute of the served items becomes a role,
+	starting at Qt::UserRole in alphabetical order. Qt::DisplayRole and Qt::EditRole return the
+	key.
+
+	Set the url property to connect to a WebSocketModelServer. For other transports, connect
+	sendMessageAsByteArray() and receiveMessage() instead.
+
+	Edits through setData(), removeRows() and insertItem() are not applied locally. They are
+	collected and sent to the server on submit() in the order they were made, and show up in
+	the model once the server reports the resulting changes. Each submit() is a single request
+	to the server, which is answered with replyReceived(). When connected through url,
+	requests made while not connected, and requests still unanswered when the connection is
+	lost, are answered with an error. */
+class RemoteItemModel : public QAbstractListModel
+{
+	Q_OBJECT
+
+	/// WebSocket URL of the model, e.g. "ws://localhost:1234/path"
+	Q_PROPERTY(QUrl url READ url WRITE setUrl NOTIFY urlChanged)
+
+	/// Whether the WebSocket is connected
+	Q_PROPERTY(bool connected READ isConnected NOTIFY connectedChanged)
+
+	/// Name of the attribute used as unique key
+	/** Sent by the server. */
+	Q_PROPERTY(QString keyName READ keyName NOTIFY keyNameChanged)
+
+	/// Sequence number of the last message from the server
+	/** Only sent by servers that persist the model, otherwise -1. Used to only get the missed
+		changes when reconnecting. */
+	Q_PROPERTY(qint64 sequence READ sequence NOTIFY sequenceChanged)
+
+	/// Send edits automatically
+	/** When true, submit() is called automatically when returning to the event loop, so all
+		edits made in one go are sent together. Default is "true". */
+	Q_PROPERTY(bool autoSubmit READ autoSubmit WRITE setAutoSubmit NOTIFY autoSubmitChanged)
+
+public:
+	explicit RemoteItemModel(QObject* parent = nullptr);
+
+	QUrl url() const {return mUrl;}
+
+	bool isConnected() const {return mConnected;}
+
+	QString keyName() const {return mKeyName;}
+
+	qint64 sequence() const {return mSequence;}
+
+	bool autoSubmit() const {return mAutoSubmit;}
+
+	/// @return Role for an attribute name, or -1 if there is no such attribute
+	int roleForName(const QString& name) const;
+
+	int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+	QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+	QHash<int, QByteArray> roleNames() const override;
+
+	/// Queue a change of an attribute
+	/** Only the attribute roles starting at Qt::UserRole can be changed, except for the key.
+		Since views edit Qt::EditRole, which is the key, items are not reported as editable. */
+	bool setData(const QModelIndex& index, const QVariant& value, int role = Qt::EditRole) override;
+
+	/// Queue removal of rows
+	bool removeRows(int row, int count, const QModelIndex& parent = QModelIndex()) override;
+
+	/// Queue insertion of an item
+	/** If the item contains the key attribute, the server uses it as key. Otherwise it is up to
+		the server's model. */
+	void insertItem(const QVariantMap& item);
+
+	/// Id of the request sent by the last submit() that had edits to send
+	/** Compare with the id of replyReceived(). 0 if nothing was sent yet. */
+	qint64 lastRequestId() const {return mLastRequestId;}
+
+	void setVariantToJsonValueFunction(std::function<QJsonValue (const QVariant&)> variantToJsonValueFunction) {mVariantToJsonValueFunction = variantToJsonValueFunction;}
+	void setJsonValueToVariantFunction(std::function<QVariant (const QJsonValue&)> jsonValueToVariantFunction) {mJsonValueToVariantFunction = jsonValueToVariantFunction;}
+
+Q_SIGNALS:
+	/// Send message to server
+	/** Emitted for all messages, also when connected through url. */
+	void sendMessageAsByteArray(const QByteArray& message);
+
+	/// A message from the server was applied to the model
+	/** Carries the message as received, e.g. for forwarding it to other clients. */
+	void messageReceived(const QByteArray& message);
+
+	/// The server replied to a request
+	/** @param id Id of the request, as sent with it
+		@param error Error message, or empty if the request succeeded */
+	void replyReceived(const QJsonValue& id, const QString& error);
+
+	void urlChanged(const QUrl& url);
+
+	void connectedChanged(bool connected);
+
+	void keyNameChanged(const QString& keyName);
+
+	void sequenceChanged(qint64 sequence);
+
+	void autoSubmitChanged(bool autoSubmit);
+
+public Q_SLOTS:
+	/// Handle JSON message from server
+	void receiveMessage(const QByteArray& message);
+
+	/// Send an already encoded JSON message to the server
+	void sendMessage(const QByteArray& message);
+
+	/// Send queued edits to the server
+	bool submit() override;
+
+	/// Discard queued edits
+	void revert() override;
+
+	void setUrl(const QUrl& url);
+
+	void setAutoSubmit(bool autoSubmit);
+
+private:
+	void applyOperation(const QJsonObject& object);
+	void applyRowData(const QJsonObject& object);
+	void applyRowsInserted(const QJsonObject& object);
+	void applyRowsRemoved(const QJsonObject& object);
+	void applyRowDataChanged(const QJsonObject& object);
+
+	/// Take role names from an item
+	void setRoleNames(const QJsonObject& item);
+	void setRow(int row, const QJsonObject& item);
+	QString rowKey(int row) const;
+
+	void setConnected(bool connected);
+	void openSocket();
+	void scheduleSubmit();
+	/// Items of the last pending operation, or of a new one if the last is of another kind
+	QJsonObject& pendingKeyedItems(const QString& operation);
+	QJsonArray& pendingItems(const QString& operation);
+	void sendOperation(const QJsonObject& object);
+
+	QUrl mUrl;
+	QWebSocket* mSocket = nullptr;
+	QTimer* mReconnectTimer;
+	bool mConnected = false;
+	qint64 mSequence = -1;
+	QString mEpoch; ///< Of mSequence
+
+	QString mKeyName;
+	int mKeyColumn = -1;
+	QVector<QString> mRoleNames; ///< Role Qt::UserRole + i is at index i
+	QVector<QVariant> mValues; ///< Row-major, mRoleNames.size() values per row
+	int mRowCount = 0;
+
+	/// Edit operation waiting for submit()
+	struct PendingOperation
+	{
+		QString operation;
+		bool keyed; ///< Items are in keyedItems by key, otherwise in items
+		QJsonObject keyedItems;
+		QJsonArray items;
+	};
+
+	QVector<PendingOperation> mPendingOperations; ///< In the order of the edits
+	bool mAutoSubmit = true;
+	bool mSubmitScheduled = false;
+	qint64 mLastRequestId = 0;
+	QSet<qint64> mSentRequestIds; ///< Sent through mSocket, not answered yet
+
+	std::function<QJsonValue (const QVariant&)> mVariantToJsonValueFunction;
+	std::function<QVariant (const QJsonValue&)> mJsonValueToVariantFunction;
+};
+
+} // namespace qtmodelserver
+
+#endif // QTMODELSERVER_REMOTEITEMMODEL_H
@@ -0,0 +1,173 @@
+/* StreamTransport.cpp
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "StreamTransport.h"
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QtEndian>
+#include <QTimer>
+#include <QDebug>
+
+namespace qtmodelserver
+{
+
+StreamTransport::StreamTransport(QObject* parent) :
+	ModelTransport(parent)
+{
+
+}
+
+StreamTransport::~StreamTransport()
+{
+	// Also covers connections that did not send their path yet:
+	const QList<QIODevice*> devices = findChildren<QIODevice*>();
+	for(QIODevice* device : devices)
+		disconnect(device, nullptr, this, nullptr);
+}
+
+bool StreamTransport::listen(const QString& name)
+{
+	if(!mLocalServer)
+	{
+		mLocalServer = new QLocalServer(this);
+		connect(mLocalServer, &QLocalServer::newConnection, this, &StreamTransport::onNewLocalConnection);
+	}
+	if(!mLocalServer->listen(name))
+	{
+		qWarning() << "listen() failed:" << mLocalServer->errorString();
+		return false;
+	}
+	return true;
+}
+
+bool StreamTransport::listen(const QHostAddress& address, quint16 port)
+{
+	if(!mTcpServer)
+	{
+		mTcpServer = new QTcpServer(this);
+		connect(mTcpServer, &QTcpServer::newConnection, this, &StreamTransport::onNewTcpConnection);
+	}
+	if(!mTcpServer->listen(address, port))
+	{
+		qWarning() << "listen() failed:" << mTcpServer->errorString();
+		return false;
+	}
+	return true;
+}
+
+void StreamTransport::writeMessage(QObject* connection, const QByteArray& message)
+{
+	QIODevice* device = static_cast<QIODevice*>(connection);
+	char header[4];
+	qToBigEndian<quint32>(quint32(message.size()), header);
+	device->write(header, sizeof(header));
+	device->write(message);
+}
+
+void StreamTransport::closeConnection(QObject* connection)
+{
+	QIODevice* device = static_cast<QIODevice*>(connection);
+	device->close();
+	device->deleteLater();
+}
+
+void StreamTransport::onNewLocalConnection()
+{
+	while(QLocalSocket* socket = mLocalServer->nextPendingConnection())
+	{
+		connect(socket, &QLocalSocket::disconnected, this, [this, socket](){connectionClosed(socket);});
+		watchConnection(socket);
+	}
+}
+
+void StreamTransport::onNewTcpConnection()
+{
+	while(QTcpSocket* socket = mTcpServer->nextPendingConnection())
+	{
+		socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+		connect(socket, &QTcpSocket::disconnected, this, [this, socket](){connectionClosed(socket);});
+		watchConnection(socket);
+	}
+}
+
+void StreamTransport::watchConnection(QIODevice* device)
+{
+	connect(device, &QIODevice::readyRead, this, [this, device](){readFrames(device);});
+
+	// Canceled by the device's deletion:
+	QTimer::singleShot(pathTimeout, device, [this, device]()
+	{
+		if(clientId(device))
+			return;
+		qWarning() << "No path received in time";
+		device->close(); // Results in connectionClosed()
+	});
+}
+
+void StreamTransport::readFrames(QIODevice* device)
+{
+	char header[4];
+	while(device->bytesAvailable() >= qint64(sizeof(header)))
+	{
+		device->peek(header, sizeof(header));
+		const quint32 size = qFromBigEndian<quint32>(header);
+		const quint32 maxSize = clientId(device) ? quint32(maxFrameSize) : quint32(maxPathFrameSize); // The path comes first
+		if(size > maxSize)
+		{
+			qWarning() << "Frame too large:" << size;
+			device->close(); // Results in connectionClosed()
+			return;
+		}
+		if(device->bytesAvailable() < qint64(sizeof(header) + size))
+			return; // Wait for the rest
+
+		device->read(header, sizeof(header));
+		const QByteArray payload = device->read(size);
+
+		const quint64 id = clientId(device);
+		if(id)
+			Q_EMIT messageReceived(id, payload);
+		else
+			addClientForResource(device, QString::fromUtf8(payload)); // First frame is the path
+	}
+}
+
+void StreamTransport::connectionClosed(QIODevice* device)
+{
+	const quint64 id = clientId(device);
+	if(id)
+		removeClient(id);
+	else
+		disconnect(device, nullptr, this, nullptr);
+	device->deleteLater();
+}
+
+} // namespace qtmodelserver
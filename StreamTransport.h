@@ -0,0 +1,93 @@
+/* StreamTransport.h
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef QTMODELSERVER_STREAMTRANSPORT_H
+#define QTMODELSERVER_STREAMTRANSPORT_H
+
+#include "ModelTransport.h"
+#include <QHostAddress>
+
+class QIODevice;
+class QLocalServer;
+class QTcpServer;
+
+namespace qtmodelserver
+{
+
+/// Serves models over plain TCP or local sockets
+/** Avoids the HTTP upgrade and WebSocket framing for clients on the same host or network.
+	Every message in either direction is a frame consisting of its size as a 32 bit big endian
+	integer, followed by that many bytes of payload. The payload of the first frame sent by the
+	client is the path of the model, optionally followed by "?" and a query as with WebSocket
+	URLs. It must arrive within pathTimeout milliseconds. All others are JSON messages as with
+	WebSockets. */
+class StreamTransport : public ModelTransport
+{
+	Q_OBJECT
+public:
+	/// Maximum payload size accepted from clients
+	static const quint32 maxFrameSize = 64 * 1024 * 1024;
+
+	/// Maximum payload size of the first frame with the path
+	static const quint32 maxPathFrameSize = 4096;
+
+	/// Milliseconds a new connection has to send its path, otherwise it is closed
+	static const int pathTimeout = 10000;
+
+	explicit StreamTransport(QObject* parent = nullptr);
+	~StreamTransport();
+
+	/// Listen on a local socket
+	/** Unix domain socket or named pipe, see QLocalServer::listen(). */
+	bool listen(const QString& name);
+
+	/// Listen on a TCP port
+	bool listen(const QHostAddress& address, quint16 port);
+
+protected:
+	void writeMessage(QObject* connection, const QByteArray& message) override;
+	void closeConnection(QObject* connection) override;
+
+protected Q_SLOTS:
+	void onNewLocalConnection();
+	void onNewTcpConnection();
+
+private:
+	/// Read frames whenever available and close the connection if it doesn't send its path
+	void watchConnection(QIODevice* device);
+	void readFrames(QIODevice* device);
+	void connectionClosed(QIODevice* device);
+
+	QLocalServer* mLocalServer = nullptr;
+	QTcpServer* mTcpServer = nullptr;
+};
+
+} // namespace qtmodelserver
+
+#endif // QTMODELSERVER_STREAMTRANSPORT_H
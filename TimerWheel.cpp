@@ -0,0 +1,86 @@
+/* TimerWheel.cpp
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "TimerWheel.h"
+#include <QTimer>
+
+namespace qtmodelserver
+{
+
+TimerWheel::TimerWheel(int resolution, int slotCount, QObject* parent) :
+	QObject(parent),
+	mTimer(new QTimer(this)),
+	mResolution(qMax(resolution, 1)),
+	mSlots(qMax(slotCount, 1))
+{
+	mTimer->setInterval(mResolution);
+	mTimer->setTimerType(Qt::PreciseTimer);
+	connect(mTimer, &QTimer::timeout, this, &TimerWheel::tick);
+}
+
+void TimerWheel::schedule(quint64 id, int delay)
+{
+	// Round up, and at least until the next tick:
+	const int ticks = qMax((delay + mResolution - 1) / mResolution, 1);
+	const int slot = (mCurrentSlot + ticks) % mSlots.size();
+	mSlots[slot].append(Entry{id, (ticks - 1) / mSlots.size()});
+
+	if(mPendingCount++ == 0)
+		mTimer->start();
+}
+
+void TimerWheel::tick()
+{
+	mCurrentSlot = (mCurrentSlot + 1) % mSlots.size();
+
+	// Take the due entries first, since slots may change from within expired():
+	QVector<quint64> due;
+	QVector<Entry>& entries = mSlots[mCurrentSlot];
+	for(int i = 0; i < entries.size();)
+	{
+		if(entries[i].turns > 0)
+		{
+			--entries[i].turns;
+			++i;
+			continue;
+		}
+		due.append(entries[i].id);
+		entries[i] = entries.last(); // Order within a slot doesn't matter
+		entries.removeLast();
+	}
+
+	mPendingCount -= due.size();
+	if(mPendingCount == 0)
+		mTimer->stop();
+
+	for(quint64 id : qAsConst(due))
+		Q_EMIT expired(id);
+}
+
+} // namespace qtmodelserver
@@ -0,0 +1,83 @@
+/* TimerWheel.h
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef QTMODELSERVER_TIMERWHEEL_H
+#define QTMODELSERVER_TIMERWHEEL_H
+
+#include <QObject>
+#include <QVector>
+
+class QTimer;
+
+namespace qtmodelserver
+{
+
+/// Many timeouts driven by a single timer
+/** Timeouts are kept in a ring of slots, one per tick of the given resolution, so scheduling
+	and expiring is constant time no matter how many timeouts are pending. Timeouts are rounded
+	up to the resolution. The timer only runs while timeouts are pending.
+
+	Timeouts are identified by an ID chosen by the caller. They can't be cancelled, so ignore
+	expired() for IDs that are no longer of interest. */
+class TimerWheel : public QObject
+{
+	Q_OBJECT
+public:
+	/// @param resolution Tick interval in milliseconds
+	/// @param slotCount Number of slots. Longer timeouts take more than one turn of the wheel.
+	explicit TimerWheel(int resolution = 50, int slotCount = 256, QObject* parent = nullptr);
+
+	int resolution() const {return mResolution;}
+
+	/// Emit expired() with the given ID after delay milliseconds
+	void schedule(quint64 id, int delay);
+
+Q_SIGNALS:
+	void expired(quint64 id);
+
+private Q_SLOTS:
+	void tick();
+
+private:
+	struct Entry
+	{
+		quint64 id;
+		int turns; ///< Full turns of the wheel left
+	};
+
+	QTimer* mTimer;
+	int mResolution;
+	QVector<QVector<Entry>> mSlots;
+	int mCurrentSlot = 0;
+	int mPendingCount = 0;
+};
+
+} // namespace qtmodelserver
+
+#endif // QTMODELSERVER_TIMERWHEEL_H
@@ -28,94 +28,539 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "WebSocketModelServer.h"
-#include <QWebSocketServer>
-#include <QWebSocket>
+#include "WebSocketTransport.h"
+#include "RemoteItemModel.h"
+#include "ModelStore.h"
+#include "TimerWheel.h"
+#include <QThread>
+#include <QUrlQuery>
+#include <QtMath>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QJsonValue>
+#include <QDebug>
 
 namespace qtmodelserver
 {
 
 WebSocketModelServer::WebSocketModelServer(QObject* parent) :
 	QObject(parent),
-	mWebSocketServer(new QWebSocketServer(QStringLiteral("Echo Server"), QWebSocketServer::NonSecureMode, this)),
+	mAcceptor(new ConnectionAcceptor(this)),
+	mTimerWheel(new TimerWheel(50, 256, this)),
 	mVariantToJsonValueFunction(QJsonValue::fromVariant),
 	mJsonValueToVariantFunction([](const QJsonValue& v){return v.toVariant();})
 
 {
-
+	qRegisterMetaType<qintptr>("qintptr");
+	connect(mAcceptor, &ConnectionAcceptor::newConnectionDescriptor, this, &WebSocketModelServer::onNewConnection);
+	connect(mTimerWheel, &TimerWheel::expired, this, &WebSocketModelServer::onThrottleTimeout);
 }
 
 WebSocketModelServer::~WebSocketModelServer()
 {
-	mWebSocketServer->close();
-	qDeleteAll(m_clients.begin(), m_clients.end());
+	mAcceptor->close();
+	for(QThread* thread : qAsConst(mIoThreads))
+		thread->quit();
+	for(QThread* thread : qAsConst(mIoThreads))
+		thread->wait();
 	qDeleteAll(mModels.begin(), mModels.end());
+	qDeleteAll(mThrottleGroups.begin(), mThrottleGroups.end());
 }
 
-void WebSocketModelServer::setModel(QAbstractItemModel* model, int keyRole, const QString& path, bool useColumns)
+void WebSocketModelServer::addModel(QAbstractItemModel* model, int keyRole, const QString& path, bool useColumns)
 {
-	Q_ASSERT(!mWebSocketServer->isListening());
+	removeModel(path);
 
 	JsonViewModel* m = new JsonViewModel(this);
+	m->setAttached(false); // Attached when the first client subscribes
 	m->setModel(model);
 	m->setKeyItem(keyRole);
 	m->setUseColumns(useColumns);
 	m->setJsonValueToVariantFunction(mJsonValueToVariantFunction);
 	m->setVariantToJsonValueFunction(mVariantToJsonValueFunction);
-	if(mModels.contains(path))
-		delete mModels.value(path);
-	mModels[path] = m;
+	mModels.insert(path, m);
+
+	for(ModelTransport* transport : qAsConst(mTransports))
+		connectTransport(m, path, transport);
 }
 
-void WebSocketModelServer::listen(quint16 port)
+void WebSocketModelServer::addRelay(const QUrl& upstreamUrl, const QString& path)
+{
+	removeModel(path);
+
+	RemoteItemModel* mirror = new RemoteItemModel(this);
+	mirror->setJsonValueToVariantFunction(mJsonValueToVariantFunction);
+	mirror->setVariantToJsonValueFunction(mVariantToJsonValueFunction);
+
+	// Only used for snapshots, so it stays detached. Roles change with upstream resets:
+	JsonViewModel* m = new JsonViewModel(this);
+	m->setAttached(false);
+	m->setCacheRoleNames(false);
+	m->setModel(mirror);
+	connect(mirror, &QAbstractItemModel::modelReset, m, [m, mirror]()
+	{
+		m->setKeyItem(mirror->roleForName(mirror->keyName()));
+	});
+	connect(mirror, &RemoteItemModel::messageReceived, m, &JsonViewModel::forwardMessage);
+	connect(mirror, &RemoteItemModel::replyReceived, this, &WebSocketModelServer::onRelayReply);
+	connect(mirror, &RemoteItemModel::connectedChanged, this, [this, path](bool connected)
+	{
+		if(!connected)
+			failRelayRequests(path, QStringLiteral("Upstream connection lost"));
+	});
+
+	mModels.insert(path, m);
+	mRelays.insert(path, mirror);
+	mRelayUrls.insert(path, upstreamUrl);
+	for(ModelTransport* transport : qAsConst(mTransports))
+		connectTransport(m, path, transport);
+
+	// Connected upstream once the first client comes, see onClientConnected()
+}
+
+void WebSocketModelServer::replaceModel(const QString& path, QAbstractItemModel* model)
 {
-	if (mWebSocketServer->listen(QHostAddress::Any, port))
+	JsonViewModel* m = mModels.value(path);
+	if(!m || mRelays.contains(path))
 	{
-		connect(mWebSocketServer, &QWebSocketServer::newConnection, this, &WebSocketModelServer::onNewConnection);
-//		connect(m_pWebSocketServer, &QWebSocketServer::closed, this, &WebSocketViewModel::closed);
+		qWarning() << "No model to replace at" << path;
+		return;
 	}
-	else
-		qWarning() << "listen() failed:" << mWebSocketServer->errorString();
+	m->setModel(model);
 }
 
-void WebSocketModelServer::onNewConnection()
+bool WebSocketModelServer::setModelStore(const QString& path, const QString& fileName, int snapshotInterval)
 {
-	QWebSocket* socket = mWebSocketServer->nextPendingConnection();
-	auto path = socket->requestUrl().path();
+	JsonViewModel* m = mModels.value(path);
+	if(!m || mRelays.contains(path))
+	{
+		qWarning() << "No model to store at" << path;
+		return false;
+	}
 
-	if(mModels.contains(path))
+	ModelStore* store = new ModelStore(fileName, this);
+	store->setSnapshotInterval(snapshotInterval);
+	if(!store->open())
 	{
-		JsonViewModel* model = mModels.value(path);
-		Q_ASSERT(model);
-		connect(socket, &QWebSocket::disconnected, this, &WebSocketModelServer::socketDisconnected);
-		connect(socket, SIGNAL(textMessageReceived(const QString&)), model, SLOT(receiveMessage(const QString&)));
+		delete store;
+		return false;
+	}
 
-		// Hack because QWebSocket has no slot for sending messages:
-		auto msgConnection = connect(model, &JsonViewModel::sendMessageAsString, [socket](const QString& msg){socket->sendTextMessage(msg);});
-		// Disconnecting is not done automatically, so do it manually:
-		connect(socket, &QObject::destroyed, [msgConnection](QObject*){disconnect(msgConnection);});
+	m->setStore(store);
+	delete mStores.take(path);
+	mStores.insert(path, store);
+	return true;
+}
 
-		m_clients << socket;
+void WebSocketModelServer::setParallelEncoding(const QString& path, bool parallelEncoding)
+{
+	JsonViewModel* m = mModels.value(path);
+	if(!m || mRelays.contains(path))
+	{
+		qWarning() << "No model to encode in parallel at" << path;
+		return;
+	}
+	m->setParallelEncoding(parallelEncoding);
+}
 
-		model->sendEntireData();
+void WebSocketModelServer::setUseBatchMessages(const QString& path, bool useBatchMessages)
+{
+	JsonViewModel* m = mModels.value(path);
+	if(!m || mRelays.contains(path))
+	{
+		qWarning() << "No model to send batch messages for at" << path;
+		return;
 	}
-	else
+	m->setUseBatchMessages(useBatchMessages);
+}
+
+void WebSocketModelServer::removeModel(const QString& path)
+{
+	JsonViewModel* model = mModels.take(path);
+	if(!model)
+		return;
+
+	const QList<quint64> clients = mClientsByPath.values(path);
+	mClientsByPath.remove(path);
+	for(quint64 clientId : clients)
+	{
+		ModelTransport* transport = mClients.take(clientId).transport;
+		QMetaObject::invokeMethod(transport, "closeClient", Q_ARG(quint64, clientId));
+	}
+	const QList<quint64> throttleGroups = mThrottleGroupsByPath.values(path);
+	mThrottleGroupsByPath.remove(path);
+	for(quint64 groupId : throttleGroups)
+		delete mThrottleGroups.take(groupId);
+	model->setStore(nullptr);
+	model->setAttached(false);
+	model->deleteLater();
+	delete mStores.take(path);
+
+	RemoteItemModel* mirror = mRelays.take(path);
+	if(mirror)
+	{
+		disconnect(mirror, nullptr, this, nullptr);
+		failRelayRequests(path, QString()); // The clients are gone already
+		mirror->setUrl(QUrl());
+		mirror->deleteLater();
+	}
+	mRelayUrls.remove(path);
+}
+
+void WebSocketModelServer::setIoThreadCount(int count)
+{
+	Q_ASSERT(mWebSocketTransports.isEmpty());
+	mIoThreadCount = qMax(count, 0);
+}
+
+void WebSocketModelServer::setUseBinaryMessages(bool useBinaryMessages)
+{
+	Q_ASSERT(mWebSocketTransports.isEmpty());
+	mUseBinaryMessages = useBinaryMessages;
+}
+
+void WebSocketModelServer::listen(quint16 port)
+{
+	if(mWebSocketTransports.isEmpty())
+		createWebSocketTransports();
+
+	if(!mAcceptor->listen(QHostAddress::Any, port))
+		qWarning() << "listen() failed:" << mAcceptor->errorString();
+}
+
+void WebSocketModelServer::onNewConnection(qintptr socketDescriptor)
+{
+	Q_ASSERT(!mWebSocketTransports.isEmpty());
+
+	// Round robin:
+	WebSocketTransport* transport = mWebSocketTransports.at(mNextWebSocketTransport);
+	mNextWebSocketTransport = (mNextWebSocketTransport + 1) % mWebSocketTransports.size();
+	QMetaObject::invokeMethod(transport, "handleConnection", Q_ARG(qintptr, socketDescriptor));
+}
+
+void WebSocketModelServer::onClientConnected(quint64 clientId, const QString& path, const QString& query)
+{
+	ModelTransport* transport = qobject_cast<ModelTransport*>(sender());
+	Q_ASSERT(transport);
+
+	JsonViewModel* model = mModels.value(path);
+	if(!model)
 	{
 		qWarning() << "Request to unknown path" << path;
-		socket->close();
-		socket->deleteLater();
+		QMetaObject::invokeMethod(transport, "closeClient", Q_ARG(quint64, clientId));
+		return;
+	}
+
+	mClients.insert(clientId, Client{path, transport});
+	mClientsByPath.insert(path, clientId);
+	if(!mRelays.contains(path)) // Relays forward upstream messages instead
+		model->subscribe();
+	else if(mClientsByPath.count(path) == 1)
+	{
+		// The client gets the mirror's data for now, then upstream's snapshot once connected:
+		mRelays.value(path)->setUrl(mRelayUrls.value(path));
+	}
+
+	const QUrlQuery urlQuery(query);
+	bool hasSequence = false;
+	const qint64 knownSequence = urlQuery.queryItemValue(QStringLiteral("sequence")).toLongLong(&hasSequence);
+	const QString knownEpoch = urlQuery.queryItemValue(QStringLiteral("epoch"));
+
+	bool hasMaxRate = false;
+	const double maxRate = urlQuery.queryItemValue(QStringLiteral("maxRate")).toDouble(&hasMaxRate);
+	if(hasMaxRate && maxRate > 0 && !mRelays.contains(path) && model->useRowBasedProtocol())
+	{
+		addThrottledClient(clientId, maxRate, hasSequence ? knownSequence : -1, knownEpoch);
+		return;
+	}
+
+	QMetaObject::invokeMethod(transport, "acceptClient", Q_ARG(quint64, clientId), Q_ARG(QByteArrayList, model->catchUpMessages(hasSequence ? knownSequence : -1, knownEpoch)));
+}
+
+void WebSocketModelServer::onClientDisconnected(quint64 clientId)
+{
+	auto it = mClients.find(clientId);
+	if(it == mClients.end())
+		return;
+
+	const QString path = it->path;
+	const quint64 throttleGroup = it->throttleGroup;
+	mClients.erase(it);
+	mClientsByPath.remove(path, clientId);
+	if(throttleGroup)
+		removeThrottledClient(clientId, throttleGroup);
+	if(mRelays.contains(path))
+	{
+		dropRelayRequests(clientId);
+		if(!mClientsByPath.contains(path))
+			mRelays.value(path)->setUrl(QUrl()); // Lets upstream detach the model while idle
+	}
+
+	JsonViewModel* model = mModels.value(path);
+	if(model && !mRelays.contains(path))
+		model->unsubscribe();
+}
+
+void WebSocketModelServer::onMessageReceived(quint64 clientId, const QByteArray& message)
+{
+	auto it = mClients.constFind(clientId);
+	if(it == mClients.constEnd())
+		return;
+
+	RemoteItemModel* mirror = mRelays.value(it->path);
+	if(mirror)
+	{
+		// Request ids are only unique per client, so they are replaced by our own upstream:
+		QJsonObject object = QJsonDocument::fromJson(message).object();
+		auto idIt = object.find(QStringLiteral("id"));
+		if(idIt == object.end())
+		{
+			mirror->sendMessage(message);
+			return;
+		}
+		if(!mirror->isConnected())
+		{
+			sendToClient(clientId, JsonViewModel::replyMessage(*idIt, QStringLiteral("Upstream not connected")));
+			return;
+		}
+		const quint64 relayId = ++mLastRelayRequestId;
+		mRelayRequests.insert(relayId, RelayRequest{it->path, clientId, *idIt});
+		*idIt = double(relayId);
+		mirror->sendMessage(QJsonDocument(object).toJson(QJsonDocument::Compact));
+		return;
+	}
+
+	JsonViewModel* model = mModels.value(it->path);
+	if(!model)
+		return;
+
+	// The reply goes out after the changes the message caused, since both are queued in order:
+	const QByteArray reply = model->handleMessage(message);
+	if(!reply.isEmpty())
+		sendToClient(clientId, reply);
+}
+
+void WebSocketModelServer::onRelayReply(const QJsonValue& id, const QString& error)
+{
+	auto it = mRelayRequests.find(quint64(id.toDouble()));
+	if(it == mRelayRequests.end())
+		return;
+
+	const RelayRequest request = it.value();
+	mRelayRequests.erase(it);
+	sendToClient(request.clientId, JsonViewModel::replyMessage(request.id, error));
+}
+
+void WebSocketModelServer::failRelayRequests(const QString& path, const QString& error)
+{
+	for(auto it = mRelayRequests.begin(); it != mRelayRequests.end();)
+	{
+		if(it->path != path)
+		{
+			++it;
+			continue;
+		}
+		if(!error.isEmpty())
+			sendToClient(it->clientId, JsonViewModel::replyMessage(it->id, error));
+		it = mRelayRequests.erase(it);
+	}
+}
+
+void WebSocketModelServer::addThrottledClient(quint64 clientId, double maxRate, qint64 knownSequence, const QString& knownEpoch)
+{
+	Client& client = mClients[clientId];
+	JsonViewModel* model = mModels.value(client.path);
+
+	// Rounded up to the timer resolution, so that more clients share a group without exceeding
+	// their rate. Capped at an hour, which also keeps tiny rates from overflowing:
+	const int resolution = mTimerWheel->resolution();
+	const double period = qMin(1000.0 / maxRate, 3600000.0);
+	const int interval = qMax(qCeil(period / resolution), 1) * resolution;
+
+	ThrottleGroup* group = nullptr;
+	const QList<quint64> groups = mThrottleGroupsByPath.values(client.path);
+	for(quint64 groupId : groups)
+	{
+		// Pending changes partly predate a snapshot taken now, so such a group can't be joined:
+		ThrottleGroup* candidate = mThrottleGroups.value(groupId);
+		if(candidate->interval == interval && candidate->changes.isEmpty())
+		{
+			client.throttleGroup = groupId;
+			group = candidate;
+			break;
+		}
+	}
+
+	if(!group)
+	{
+		if(groups.isEmpty())
+		{
+			// Changes are only reported while needed, since that costs extra encoding in transactions:
+			const QString path = client.path;
+			connect(model, &JsonViewModel::changeSent, this, [this, path](JsonViewModel::Change change, int start, int end, const QByteArray& message)
+			{
+				onModelChanged(path, change, start, end, message);
+			});
+		}
+
+		group = new ThrottleGroup;
+		group->path = client.path;
+		group->interval = interval;
+		group->lastUpdate.start();
+		client.throttleGroup = ++mLastThrottleGroupId;
+		mThrottleGroups.insert(client.throttleGroup, group);
+		mThrottleGroupsByPath.insert(client.path, client.throttleGroup);
+	}
+
+	group->clients.append(clientId);
+	const QByteArrayList messages = model->catchUpMessages(knownSequence, knownEpoch);
+	for(const QByteArray& message : messages)
+		sendToClient(clientId, message);
+}
+
+void WebSocketModelServer::removeThrottledClient(quint64 clientId, quint64 groupId)
+{
+	ThrottleGroup* group = mThrottleGroups.value(groupId);
+	if(!group)
+		return;
+
+	group->clients.removeOne(clientId);
+	if(!group->clients.isEmpty())
+		return;
+
+	const QString path = group->path;
+	mThrottleGroupsByPath.remove(path, groupId);
+	delete mThrottleGroups.take(groupId);
+
+	JsonViewModel* model = mModels.value(path);
+	if(model && !mThrottleGroupsByPath.contains(path))
+		disconnect(model, &JsonViewModel::changeSent, this, nullptr);
+}
+
+void WebSocketModelServer::scheduleUpdate(quint64 groupId, ThrottleGroup* group)
+{
+	if(group->scheduled)
+		return;
+
+	group->scheduled = true;
+	mTimerWheel->schedule(groupId, qMax(group->interval - int(group->lastUpdate.elapsed()), 0));
+}
+
+void WebSocketModelServer::dropRelayRequests(quint64 clientId)
+{
+	for(auto it = mRelayRequests.begin(); it != mRelayRequests.end();)
+	{
+		if(it->clientId == clientId)
+			it = mRelayRequests.erase(it);
+		else
+			++it;
+	}
+}
+
+void WebSocketModelServer::sendToClient(quint64 clientId, const QByteArray& message)
+{
+	auto it = mClients.constFind(clientId);
+	if(it != mClients.constEnd())
+		QMetaObject::invokeMethod(it->transport, "sendToClient", Q_ARG(quint64, clientId), Q_ARG(QByteArray, message));
+}
+
+void WebSocketModelServer::onModelChanged(const QString& path, JsonViewModel::Change change, int start, int end, const QByteArray& message)
+{
+	const QList<quint64> groups = mThrottleGroupsByPath.values(path);
+	for(quint64 groupId : groups)
+	{
+		ThrottleGroup* group = mThrottleGroups.value(groupId);
+		switch(change)
+		{
+		case JsonViewModel::RowsInserted:
+			group->changes.rowsInserted(start, end, message);
+			break;
+		case JsonViewModel::RowsRemoved:
+			group->changes.rowsRemoved(start, end, message);
+			break;
+		case JsonViewModel::RowDataChanged:
+			group->changes.rowsChanged(start, end);
+			break;
+		case JsonViewModel::Reset:
+			group->changes.reset();
+			break;
+		}
+		scheduleUpdate(groupId, group);
 	}
 }
 
-void WebSocketModelServer::socketDisconnected()
+void WebSocketModelServer::onThrottleTimeout(quint64 groupId)
 {
-	qDebug() << "socketDisconnected()";
-	QWebSocket* client = qobject_cast<QWebSocket*>(sender());
-	if(client)
+	ThrottleGroup* group = mThrottleGroups.value(groupId);
+	if(!group)
+		return; // Removed in the meantime
+
+	group->scheduled = false;
+	JsonViewModel* model = mModels.value(group->path);
+	Q_ASSERT(model);
+
+	if(!group->changes.isEmpty() && !group->clients.isEmpty())
 	{
-		m_clients.removeAll(client);
-		client->deleteLater();
+		// Encoded once for the whole group:
+		const QByteArray update = group->changes.needsSnapshot() ? model->entireDataMessage() :
+			model->updateMessage(group->changes.messages(), group->changes.changedRows());
+		for(quint64 clientId : qAsConst(group->clients))
+			sendToClient(clientId, update);
 	}
+	group->changes.clear();
+	group->lastUpdate.restart();
+}
+
+void WebSocketModelServer::addTransport(ModelTransport* transport)
+{
+	Q_ASSERT(transport->thread() == thread());
+	transport->setParent(this);
+	registerTransport(transport);
+}
+
+void WebSocketModelServer::createWebSocketTransports()
+{
+	const int transportCount = qMax(mIoThreadCount, 1);
+	for(int i = 0; i < transportCount; ++i)
+	{
+		WebSocketTransport* transport = new WebSocketTransport(mIoThreadCount > 0 ? nullptr : this);
+		transport->setUseBinaryMessages(mUseBinaryMessages);
+		registerTransport(transport);
+		mWebSocketTransports.append(transport);
+
+		if(mIoThreadCount > 0)
+		{
+			QThread* thread = new QThread(this);
+			transport->moveToThread(thread);
+			connect(thread, &QThread::finished, transport, &QObject::deleteLater);
+			thread->start();
+			mIoThreads.append(thread);
+		}
+	}
+}
+
+void WebSocketModelServer::registerTransport(ModelTransport* transport)
+{
+	// Keep client IDs unique across transports:
+	transport->setClientIdBase(quint64(mTransports.size()) << 48);
+
+	connect(transport, &ModelTransport::clientConnected, this, &WebSocketModelServer::onClientConnected);
+	connect(transport, &ModelTransport::clientDisconnected, this, &WebSocketModelServer::onClientDisconnected);
+	connect(transport, &ModelTransport::messageReceived, this, &WebSocketModelServer::onMessageReceived);
+
+	for(auto it = mModels.constBegin(); it != mModels.constEnd(); ++it)
+		connectTransport(it.value(), it.key(), transport);
+
+	mTransports.append(transport);
+}
+
+void WebSocketModelServer::connectTransport(JsonViewModel* model, const QString& path, ModelTransport* transport)
+{
+	// Queued if the transport lives in another thread. The QByteArray is shared, not copied.
+	connect(model, &JsonViewModel::sendMessageAsByteArray, transport, [transport, path](const QByteArray& message)
+	{
+		transport->sendToPath(path, message);
+	});
 }
 
 } // namespace qtmodelserver
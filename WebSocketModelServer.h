@@ -31,15 +31,28 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define QTMODELSERVER_WEBSOCKETMODELSERVER_H
 
 #include "JsonViewModel.h"
+#include "ChangeConflator.h"
 #include <QObject>
-#include <QMap>
+#include <QHash>
+#include <QMultiHash>
+#include <QJsonValue>
+#include <QElapsedTimer>
+#include <QUrl>
+#include <QVector>
 
-class QWebSocketServer;
-class QWebSocket;
+class QThread;
+class QUrl;
 
 namespace qtmodelserver
 {
 
+class ConnectionAcceptor;
+class ModelStore;
+class ModelTransport;
+class RemoteItemModel;
+class TimerWheel;
+class WebSocketTransport;
+
 class WebSocketModelServer : public QObject
 {
 	Q_OBJECT
@@ -48,12 +61,97 @@ public:
 	~WebSocketModelServer();
 
 	/// Add a model to serve
-	/** Mutiple models can be served by setting a different path for each.
-		All models must be registered before calling listen()! */
-	void setModel(QAbstractItemModel* model, int keyRole, const QString& path = "/", bool useColumns = false);
+	/** Mutiple models can be served by setting a different path for each. Models can be added
+		and removed at any time, also while listening. A model already registered for the same
+		path is replaced and its clients are disconnected.
+
+		The model's signals are only connected while at least one client is subscribed to its
+		path, so idle models don't cost anything.
+
+		Clients that don't need every change can ask for at most a number of updates per second
+		with a "maxRate" URL query item, e.g. "ws://host:port/path?maxRate=2". Changes for them
+		are accumulated and sent as one "batch" message per interval, with every changed row
+		sent only once. Rates below one update per hour are treated as one per hour. Not
+		supported for relays. */
+	void addModel(QAbstractItemModel* model, int keyRole, const QString& path = "/", bool useColumns = false);
+
+	/// Stop serving the model at the given path
+	/** Clients connected to the path are disconnected. The QAbstractItemModel itself is not
+		deleted. */
+	void removeModel(const QString& path);
+
+	/// Relay a model served by another server
+	/** Keeps a local mirror of the model at upstreamUrl and serves it at the given path. Updates
+		from upstream are forwarded to the clients as received, without decoding and encoding
+		them again. Only the snapshots for newly connected clients are created from the mirror.
+		Messages from clients are forwarded upstream.
+
+		Relays can be chained to spread clients over several processes or hosts. The upstream
+		connection is only open while the relay has clients, so upstream can detach an idle
+		model, and reconnected when lost. Requests with an "id" are answered with upstream's
+		reply, or with an error if there is no upstream connection or it is lost before.
+		@see removeModel() */
+	void addRelay(const QUrl& upstreamUrl, const QString& path = "/");
+
+	/// Replace the QAbstractItemModel served at a path
+	/** Unlike addModel(), connected clients stay connected and get the new model's data. */
+	void replaceModel(const QString& path, QAbstractItemModel* model);
+
+	/// Persist the data of the model at a path
+	/** Keeps a snapshot in the given file, rewritten every snapshotInterval milliseconds, and a
+		log of all changes since in fileName + ".log". Clients that connect with the "sequence"
+		and "epoch" of the last message they got as URL query items, e.g.
+		"ws://host:port/path?sequence=123&epoch=...", get the changes since then if still
+		available, instead of the entire data. The epoch changes whenever the server restarts.
+
+		For a fast restart, add the path with a null model, set the store, and call
+		replaceModel() once the model is ready. Until then, clients get the stored data.
+		@see ModelStore */
+	bool setModelStore(const QString& path, const QString& fileName, int snapshotInterval = 60000);
+
+	/// Encode large messages of the model at a path with several threads
+	/** Speeds up snapshots of large models. Only for models whose index() and data() are
+		thread-safe. Not supported for relays.
+		@see JsonViewModel::parallelEncoding */
+	void setParallelEncoding(const QString& path, bool parallelEncoding);
+
+	/// Send the changes of a transaction on the model at a path as a single "batch" message
+	/** Only for paths whose clients all understand "batch" messages. Not supported for relays.
+		@see JsonViewModel::useBatchMessages */
+	void setUseBatchMessages(const QString& path, bool useBatchMessages);
+
+	bool hasModel(const QString& path) const {return mModels.contains(path);}
+
+	/// @deprecated Use addModel()
+	void setModel(QAbstractItemModel* model, int keyRole, const QString& path = "/", bool useColumns = false) {addModel(model, keyRole, path, useColumns);}
+
+	/// Number of threads used for WebSocket I/O
+	/** With the default of 0, handshakes, framing and sending are all done in the server's
+		thread. Otherwise connections are distributed over the given number of threads, each
+		with its own event loop. Models are still only accessed from the server's thread, and
+		their messages are encoded once and shared by all threads.
+
+		Must be set before calling listen(). */
+	void setIoThreadCount(int count);
+	int ioThreadCount() const {return mIoThreadCount;}
+
+	/// Send WebSocket binary messages instead of text ones
+	/** Binary messages are sent as encoded, which saves a conversion to UTF-16 and back per
+		message. Only enable this if all clients accept binary messages; remote-model.ts and
+		RemoteItemModel accept both. The default is text messages.
+
+		Must be set before calling listen().
+		@see WebSocketTransport::setUseBinaryMessages() */
+	void setUseBinaryMessages(bool useBinaryMessages);
+	bool useBinaryMessages() const {return mUseBinaryMessages;}
 
 	void listen(quint16 port);
 
+	/// Serve the models over an additional transport
+	/** E.g. a StreamTransport for local clients, or an InProcessTransport for tests. Takes
+		ownership. The transport must live in the server's thread. */
+	void addTransport(ModelTransport* transport);
+
 	void setVariantToJsonValueFunction(std::function<QJsonValue (const QVariant&)> variantToJsonValueFunction) {mVariantToJsonValueFunction = variantToJsonValueFunction;}
 	void setJsonValueToVariantFunction(std::function<QVariant (const QJsonValue&)> jsonValueToVariantFunction) {mJsonValueToVariantFunction = jsonValueToVariantFunction;}
 
@@ -62,13 +160,83 @@ Q_SIGNALS:
 public Q_SLOTS:
 
 protected Q_SLOTS:
-	void onNewConnection();
-	void socketDisconnected();
+	void onNewConnection(qintptr socketDescriptor);
+	void onClientConnected(quint64 clientId, const QString& path, const QString& query);
+	void onClientDisconnected(quint64 clientId);
+	void onMessageReceived(quint64 clientId, const QByteArray& message);
+	void onRelayReply(const QJsonValue& id, const QString& error);
+	void onThrottleTimeout(quint64 groupId);
 
 private:
-	QWebSocketServer* mWebSocketServer;
-	QMap<QString, JsonViewModel*> mModels;
-	QList<QWebSocket*> m_clients;
+	struct Client
+	{
+		QString path;
+		ModelTransport* transport;
+		quint64 throttleGroup = 0; ///< 0 if the client gets every message
+	};
+
+	/// Clients of a path with the same maximum update rate
+	/** They share the accumulated changes, so a change costs the same for any number of
+		clients. A client that connects while a group has pending changes starts a new group
+		with the same rate, so it gets its snapshot right away. */
+	struct ThrottleGroup
+	{
+		QString path;
+		int interval; ///< Minimum time between updates in milliseconds
+		ChangeConflator changes;
+		QVector<quint64> clients;
+		QElapsedTimer lastUpdate;
+		bool scheduled = false;
+	};
+
+	/// Client request forwarded upstream by a relay, waiting for the reply
+	struct RelayRequest
+	{
+		QString path;
+		quint64 clientId;
+		QJsonValue id; ///< As sent by the client
+	};
+
+	void createWebSocketTransports();
+	void registerTransport(ModelTransport* transport);
+	void connectTransport(JsonViewModel* model, const QString& path, ModelTransport* transport);
+	void sendToClient(quint64 clientId, const QByteArray& message);
+
+	void addThrottledClient(quint64 clientId, double maxRate, qint64 knownSequence, const QString& knownEpoch);
+	void removeThrottledClient(quint64 clientId, quint64 groupId);
+	void onModelChanged(const QString& path, JsonViewModel::Change change, int start, int end, const QByteArray& message);
+
+	/// Send the group's next update after its interval, unless already scheduled
+	void scheduleUpdate(quint64 groupId, ThrottleGroup* group);
+
+	/// Answer and forget the pending relay requests of a path
+	/** No replies are sent if error is empty. */
+	void failRelayRequests(const QString& path, const QString& error);
+
+	/// Forget the pending relay requests of a client that left
+	void dropRelayRequests(quint64 clientId);
+
+	ConnectionAcceptor* mAcceptor;
+	QVector<ModelTransport*> mTransports;
+	QVector<WebSocketTransport*> mWebSocketTransports;
+	QVector<QThread*> mIoThreads;
+	int mIoThreadCount = 0;
+	bool mUseBinaryMessages = false;
+	int mNextWebSocketTransport = 0;
+
+	QHash<QString, JsonViewModel*> mModels;
+	QHash<QString, RemoteItemModel*> mRelays; ///< Upstream mirrors of relayed paths
+	QHash<QString, QUrl> mRelayUrls; ///< Upstream URLs of relayed paths
+	QHash<QString, ModelStore*> mStores;
+	QHash<quint64, Client> mClients;
+	QMultiHash<QString, quint64> mClientsByPath;
+	QHash<quint64, RelayRequest> mRelayRequests; ///< By the id sent upstream
+	quint64 mLastRelayRequestId = 0;
+
+	TimerWheel* mTimerWheel; ///< Schedules the updates of all throttle groups
+	QHash<quint64, ThrottleGroup*> mThrottleGroups;
+	QMultiHash<QString, quint64> mThrottleGroupsByPath;
+	quint64 mLastThrottleGroupId = 0;
 
 	std::function<QJsonValue (const QVariant&)> mVariantToJsonValueFunction;
 	std::function<QVariant (const QJsonValue&)> mJsonValueToVariantFunction;
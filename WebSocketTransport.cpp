@@ -0,0 +1,116 @@
+/* WebSocketTransport.cpp
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "WebSocketTransport.h"
+#include <QWebSocketServer>
+#include <QWebSocket>
+#include <QTcpSocket>
+#include <QDebug>
+
+namespace qtmodelserver
+{
+
+WebSocketTransport::WebSocketTransport(QObject* parent) :
+	ModelTransport(parent),
+	mWebSocketServer(new QWebSocketServer(QStringLiteral("qt-model-server"), QWebSocketServer::NonSecureMode, this))
+{
+	connect(mWebSocketServer, &QWebSocketServer::newConnection, this, &WebSocketTransport::onNewConnection);
+}
+
+void WebSocketTransport::handleConnection(qintptr socketDescriptor)
+{
+	QTcpSocket* socket = new QTcpSocket;
+	if(!socket->setSocketDescriptor(socketDescriptor))
+	{
+		qWarning() << "Could not take over connection:" << socket->errorString();
+		delete socket;
+		return;
+	}
+	mWebSocketServer->handleConnection(socket); // Takes ownership
+}
+
+void WebSocketTransport::sendToPath(const QString& path, const QByteArray& message)
+{
+	const QVector<QObject*> connections = acceptedConnections(path);
+	if(connections.isEmpty())
+		return;
+
+	if(mUseBinaryMessages)
+	{
+		// Sent as encoded, without any conversion:
+		for(QObject* connection : connections)
+			static_cast<QWebSocket*>(connection)->sendBinaryMessage(message);
+		return;
+	}
+
+	// Convert once for all clients:
+	const QString text = QString::fromUtf8(message);
+	for(QObject* connection : connections)
+		static_cast<QWebSocket*>(connection)->sendTextMessage(text);
+}
+
+void WebSocketTransport::writeMessage(QObject* connection, const QByteArray& message)
+{
+	if(mUseBinaryMessages)
+		static_cast<QWebSocket*>(connection)->sendBinaryMessage(message);
+	else
+		static_cast<QWebSocket*>(connection)->sendTextMessage(QString::fromUtf8(message));
+}
+
+void WebSocketTransport::closeConnection(QObject* connection)
+{
+	QWebSocket* socket = static_cast<QWebSocket*>(connection);
+	socket->close();
+	socket->deleteLater();
+}
+
+void WebSocketTransport::onNewConnection()
+{
+	while(QWebSocket* socket = mWebSocketServer->nextPendingConnection())
+	{
+		connect(socket, &QWebSocket::disconnected, this, [this, socket]()
+		{
+			removeClient(clientId(socket));
+			socket->deleteLater();
+		});
+		connect(socket, &QWebSocket::textMessageReceived, this, [this, socket](const QString& message)
+		{
+			Q_EMIT messageReceived(clientId(socket), message.toUtf8());
+		});
+		connect(socket, &QWebSocket::binaryMessageReceived, this, [this, socket](const QByteArray& message)
+		{
+			Q_EMIT messageReceived(clientId(socket), message);
+		});
+
+		const QUrl url = socket->requestUrl();
+		addClient(socket, url.path(), url.query());
+	}
+}
+
+} // namespace qtmodelserver
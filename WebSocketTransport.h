@@ -0,0 +1,92 @@
+/* WebSocketTransport.h
+
+BSD 2-Clause License
+
+Copyright (c) 2018-2021, Fabian Herb
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef QTMODELSERVER_WEBSOCKETTRANSPORT_H
+#define QTMODELSERVER_WEBSOCKETTRANSPORT_H
+
+#include "ModelTransport.h"
+#include <QTcpServer>
+
+class QWebSocketServer;
+
+namespace qtmodelserver
+{
+
+/// Accepts TCP connections and hands out their socket descriptors
+/** The descriptors are not wrapped in a QTcpSocket here, so they can be passed on to another
+	thread. */
+class ConnectionAcceptor : public QTcpServer
+{
+	Q_OBJECT
+public:
+	explicit ConnectionAcceptor(QObject* parent = nullptr) : QTcpServer(parent) {}
+
+Q_SIGNALS:
+	void newConnectionDescriptor(qintptr socketDescriptor);
+
+protected:
+	void incomingConnection(qintptr socketDescriptor) override {Q_EMIT newConnectionDescriptor(socketDescriptor);}
+};
+
+/// Owns a set of WebSocket connections and does the I/O for them
+/** Lives in one of the I/O threads of WebSocketModelServer, or in the server's own thread. */
+class WebSocketTransport : public ModelTransport
+{
+	Q_OBJECT
+public:
+	explicit WebSocketTransport(QObject* parent = nullptr);
+
+	/// Send binary instead of text messages
+	/** Binary messages are sent as encoded. QWebSocket only takes text as QString, so text
+		messages are converted from UTF-8 to UTF-16 and back. Default is "false". Must be set
+		before any clients connect. */
+	void setUseBinaryMessages(bool useBinaryMessages) {mUseBinaryMessages = useBinaryMessages;}
+	bool useBinaryMessages() const {return mUseBinaryMessages;}
+
+public Q_SLOTS:
+	/// Take over a connection accepted by ConnectionAcceptor and do the WebSocket handshake
+	void handleConnection(qintptr socketDescriptor);
+
+	void sendToPath(const QString& path, const QByteArray& message) override;
+
+protected:
+	void writeMessage(QObject* connection, const QByteArray& message) override;
+	void closeConnection(QObject* connection) override;
+
+protected Q_SLOTS:
+	void onNewConnection();
+
+private:
+	QWebSocketServer* mWebSocketServer;
+	bool mUseBinaryMessages = false;
+};
+
+} // namespace qtmodelserver
+
+#endif // QTMODELSERVER_WEBSOCKETTRANSPORT_H
@@ -35,51 +35,37 @@ export class RemoteModel {
   private socket: WebSocket;
   private itemsSubject: BehaviorSubject<any[]> = new BehaviorSubject([]);
   private connectedSubject: BehaviorSubject<boolean> = new BehaviorSubject(false);
+  private sequence: number = -1;
+  private epoch: string = "";
+  private lastRequestId: number = 0;
+  private decoder = new TextDecoder();
+  private pendingRequests = new Map<number, {resolve: () => void, reject: (error: Error) => void}>();
   
   constructor(private url: string) {
     this.connect();
   }
 
   private connect() {
-    this.socket = new WebSocket(this.url);
+    let url = this.url;
+    if(this.sequence >= 0) {
+      // Lets the server send only what was missed, if it persists the model:
+      url += (url.indexOf("?") < 0 ? "?" : "&") + "sequence=" + this.sequence + "&epoch=" + encodeURIComponent(this.epoch);
+    }
+    this.socket = new WebSocket(url);
+    this.socket.binaryType = "arraybuffer";
     this.socket.onmessage = ((msg) => {
-      var obj = JSON.parse(msg.data);
-
-      if(obj.operation == "data") {
-        this.items = obj.items;
-      }
-      if(obj.operation == "rowData") {
-        this.items = obj.items;
-        this.keyItem = obj.key;
-      }
-      else if(obj.operation == "inserted") {
-        for(var id in obj.items) {
-          var item = obj.items[id];
-          this.items[id] = item;
-        }
+      // The server sends binary messages if configured to do so:
+      var obj = JSON.parse(typeof msg.data === "string" ? msg.data : this.decoder.decode(msg.data));
+      if(obj.operation == "ack" || obj.operation == "error") {
+        this.reply(obj);
+        return;
       }
-      else if(obj.operation == "rowsInserted") {
-        this.items.splice(obj.start, 0, ...obj.items);
+      if(obj.sequence !== undefined) {
+        this.sequence = obj.sequence;
+        this.epoch = obj.epoch || "";
       }
-      else if(obj.operation == "removed") {
-        for(var id in obj.items) {
-          delete this.items[id];
-        }
-      }
-      else if(obj.operation == "rowsRemoved") {
-        this.items.splice(obj.start, obj.end - obj.start + 1);
-      }
-      else if(obj.operation == "dataChanged") {
-        for(var id in obj.items) {
-          var item = obj.items[id];
-          if(this.items.hasOwnProperty(id))
-            this.items[id] = item;
-        }
-      }
-      else if(obj.operation == "rowDataChanged") {
-        this.items.splice(obj.start, obj.end - obj.start + 1, ...obj.items);
 
-      }
+      this.applyOperation(obj);
       if(Array.isArray(this.items))
         this.itemsSubject.next(this.items);
       else
@@ -90,30 +76,90 @@ export class RemoteModel {
     this.socket.onopen = _ => this.connectedSubject.next(true);
   }
 
+  private applyOperation(obj: any) {
+    if(obj.operation == "data") {
+      this.items = obj.items;
+    }
+    if(obj.operation == "rowData") {
+      this.items = obj.items;
+      this.keyItem = obj.key;
+    }
+    else if(obj.operation == "inserted") {
+      for(var id in obj.items) {
+        var item = obj.items[id];
+        this.items[id] = item;
+      }
+    }
+    else if(obj.operation == "rowsInserted") {
+      this.items.splice(obj.start, 0, ...obj.items);
+    }
+    else if(obj.operation == "removed") {
+      for(var id in obj.items) {
+        delete this.items[id];
+      }
+    }
+    else if(obj.operation == "rowsRemoved") {
+      this.items.splice(obj.start, obj.end - obj.start + 1);
+    }
+    else if(obj.operation == "dataChanged") {
+      for(var id in obj.items) {
+        var item = obj.items[id];
+        if(this.items.hasOwnProperty(id))
+          this.items[id] = item;
+      }
+    }
+    else if(obj.operation == "rowDataChanged") {
+      this.items.splice(obj.start, obj.end - obj.start + 1, ...obj.items);
+    }
+    else if(obj.operation == "batch") {
+      for(let item of obj.items)
+        this.applyOperation(item);
+    }
+  }
+
   getItems(): BehaviorSubject<any[]> {
     return this.itemsSubject;
   }
 
-  editItem(item: any) {
+  editItem(item: any): Promise<void> {
+    return this.request(this.changeDataOperation(item));
+  }
+
+  removeItem(id: string): Promise<void> {
+    return this.request(this.removeOperation(id));
+  }
+
+  insertItem(item: any): Promise<void> {
+    return this.request(this.insertOperation(item));
+  }
+
+  // Takes operations from changeDataOperation(), removeOperation() and insertOperation().
+  // The server applies them in order and sends the resulting changes as one update.
+  transaction(operations: any[]): Promise<void> {
+    return this.request({
+      operation: "transaction",
+      operations: operations
+    });
+  }
+
+  changeDataOperation(item: any): any {
     let id: string = String(item[this.keyItem]);
     let items = {};
     items[id] = item;
-    let msg = {
+    return {
       operation: "changeData",
       items: items
     };
-    this.socket.send(JSON.stringify(msg));
   }
 
-  removeItem(id: string) {
-    let msg = {
+  removeOperation(id: string): any {
+    return {
       operation: "remove",
       items: [id]
     };
-    this.socket.send(JSON.stringify(msg));
   }
 
-  insertItem(item: any) {
+  insertOperation(item: any): any {
     let items;
     if(item.hasOwnProperty(this.keyItem)) {
       items = {};
@@ -122,18 +168,39 @@ export class RemoteModel {
     else {
       items = [item];
     }
-    let msg = {
+    return {
       operation: "insert",
       items: items
     };
-    this.socket.send(JSON.stringify(msg));
   }
 
   getConnected() : BehaviorSubject<boolean> {
     return this.connectedSubject;
   }
 
+  // Does not wait for the replies to previous requests
+  private request(msg: any): Promise<void> {
+    msg.id = ++this.lastRequestId;
+    return new Promise<void>((resolve, reject) => {
+      this.pendingRequests.set(msg.id, {resolve: resolve, reject: reject});
+      this.socket.send(JSON.stringify(msg));
+    });
+  }
+
+  private reply(obj: any) {
+    let request = this.pendingRequests.get(obj.id);
+    if(!request)
+      return;
+    this.pendingRequests.delete(obj.id);
+    if(obj.operation == "ack")
+      request.resolve();
+    else
+      request.reject(new Error(obj.message));
+  }
+
   private disconnected() {
+    this.pendingRequests.forEach(request => request.reject(new Error("Connection lost")));
+    this.pendingRequests.clear();
     this.connectedSubject.next(false);
     setTimeout(this.connect.bind(this), 5000);
   }